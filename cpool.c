@@ -1,30 +1,85 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* SCHED_BATCH, SCHED_IDLE, syscall() */
+#elif !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+#endif
+
+#define CPOOL_INTERNAL_ /* private declarations of cpool.h */
 #include "cpool.h"
+#include "cpool_sdt.h"
+#include "cpool_queue.h"
 #include <threads.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CPOOL_HAVE_PTHREAD 1
+#include <pthread.h>
+#include <sched.h>
+#endif
+#ifdef __linux__
+#define CPOOL_HAVE_FUTEX 1
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef SYS_membarrier
+#define CPOOL_HAVE_MEMBARRIER 1
+#endif
+#endif
+
+/* USDT probes, see cpool_sdt.h. Arguments are documented at their call sites. */
+CPOOL_SDT_DEFINE(enqueue);
+CPOOL_SDT_DEFINE(enqueue_blocked);
+CPOOL_SDT_DEFINE(dequeue);
+CPOOL_SDT_DEFINE(job_start);
+CPOOL_SDT_DEFINE(job_end);
+CPOOL_SDT_DEFINE(park);
+CPOOL_SDT_DEFINE(unpark);
+CPOOL_SDT_DEFINE(future_complete);
 
 struct cpool_future {
+    atomic_int flag;  /* first, for the inline cpool_future_done() */
     mtx_t mutex;
     cnd_t cond;
-    int flag;
+    int allocated; /* 0 if in caller-owned storage, see cpool_future_init() */
 };
 
+_Static_assert(sizeof(struct cpool_future) <= sizeof(cpool_future_storage), "cpool_future_storage is too small");
+_Static_assert(_Alignof(struct cpool_future) <= _Alignof(cpool_future_storage), "cpool_future_storage is misaligned");
+
+static int
+cpool_future_setup(cpool_future* future, int allocated)
+{
+    future->flag = 0;
+    future->allocated = allocated;
+    if (mtx_init(&future->mutex, mtx_plain) != thrd_success) return 1;
+    if (cnd_init(&future->cond) != thrd_success) {
+        mtx_destroy(&future->mutex);
+        return 1;
+    }
+    return 0;
+}
+
 static cpool_future*
 cpool_future_create(void)
 {
     cpool_future* ptr = malloc(sizeof(*ptr));
-    if (!ptr) goto end;
-    ptr->flag = 0;
-    if (mtx_init(&ptr->mutex, mtx_plain) != thrd_success) goto mutex_fail;
-    if (cnd_init(&ptr->cond) != thrd_success) goto cond_fail;
-    goto end;
-
-cond_fail:
-    mtx_destroy(&ptr->mutex);
-mutex_fail:
-    free(ptr);
-    ptr = NULL;
-end:
+    if (ptr && cpool_future_setup(ptr, 1)) {
+        free(ptr);
+        ptr = NULL;
+    }
     return ptr;
 }
 
@@ -33,216 +88,2603 @@ cpool_future_destroy(cpool_future* future)
 {
     cnd_destroy(&future->cond);
     mtx_destroy(&future->mutex);
-    free(future);
+    if (future->allocated) free(future);
+}
+
+cpool_future*
+cpool_future_init(cpool_future_storage* storage)
+{
+    cpool_future* future = (cpool_future*)storage;
+    return cpool_future_setup(future, 0) ? NULL : future;
 }
 
+/* Upper bounds (inclusive) of latency histogram buckets, in nanoseconds.
+ * The last, implicit bucket is +Inf.
+ */
+static const uint64_t hist_bounds[] = {
+    1000, 2500, 5000,                                   /* 1us .. */
+    10000, 25000, 50000,
+    100000, 250000, 500000,
+    1000000, 2500000, 5000000,                          /* 1ms .. */
+    10000000, 25000000, 50000000,
+    100000000, 250000000, 500000000,
+    1000000000, 2500000000, 5000000000, 10000000000,    /* 1s .. 10s */
+};
+#define HIST_BUCKETS (sizeof(hist_bounds) / sizeof(hist_bounds[0]) + 1)
+
+typedef struct {
+    uint64_t count[HIST_BUCKETS]; /* non-cumulative */
+    uint64_t sum_ns;
+} cpool_hist;
+
+/* Pool statistics. Protected by the pool mutex. */
+typedef struct {
+    uint64_t nb_enqueued, nb_completed;
+    uint64_t nb_enqueue_blocked;   /* enqueue calls which had to wait for a free slot */
+    uint64_t enqueue_block_ns;     /* total time spent waiting for a free slot */
+    uint64_t nb_engine_switches;   /* switches of the adaptive engine */
+    uint64_t nb_handoffs;          /* jobs handed off to a parked worker, bypassing the queue */
+    uint64_t nb_steals;            /* jobs taken by a worker from the queue of another cache domain */
+    uint64_t nb_membarriers;       /* membarrier() calls of parking workers */
+    uint64_t nb_fence_switches;    /* switches between asymmetric and symmetric fences */
+    cpool_hist wait;               /* time from enqueue to job start */
+    cpool_hist run;                /* job run time */
+} cpool_stats;
+
+typedef struct cpool_worker cpool_worker;
+
+struct cpool_worker {
+    cpool* pool;
+    thrd_t thread;
+    size_t index;
+    long tid;                        /* OS thread ID (Linux), set on startup. Protected by the pool mutex. */
+    atomic_ullong job_start;         /* start time of the running job, 0 if none. Read by the watchdog. */
+    _Atomic(cpool_func_t) job_func;  /* function of the running job. Read by the watchdog. */
+    int retired;                     /* replaced by the watchdog, exit once the current job is done.
+                                      * Protected by the pool mutex.
+                                      */
+    uint64_t reported_start;         /* watchdog-private: `job_start` of the last reported job */
+    size_t domain;                   /* cache domain, whose queue the worker serves first. 0 without domains. */
+
+    /* Parking, see park_wait(). Protected by the pool mutex.
+     * A parked worker is on the idle list, and sleeps until it is taken off the list and woken,
+     * so that each wakeup reaches exactly one worker.
+     */
+#ifdef CPOOL_HAVE_FUTEX
+    atomic_uint park_word;           /* futex word, bumped by park_wake() */
+#else
+    cnd_t cond;
+#endif
+    int parked;
+    cpool_worker* idle_next;
+    int has_mail;                    /* `mailbox` holds a job handed off by an enqueue, counted in `nb_working` */
+    cpool_work mailbox;
+};
+
+/* Workload recording. Records are buffered and written out in the format described in cpool.h. */
+#define RECORD_MAGIC "CPOOLREC"
+#define RECORD_VERSION 1
+#define RECORD_SIZE 40
+#define RECORD_BUFFER 1024 /* records */
+#define RECORD_BUFFER_SIZE (RECORD_SIZE * RECORD_BUFFER)
+
+/* Records are appended to `buf` under the pool's `record_mutex`, and full buffers are written out under
+ * `write_mutex` only, alternating with `spare`, see record_job().
+ */
+typedef struct {
+    FILE* out;
+    uint64_t start_ns;
+    unsigned char* buf;
+    unsigned char* spare;
+    size_t len;          /* bytes in buf */
+    mtx_t write_mutex;   /* held while writing to `out` */
+    int error;           /* protected by `write_mutex` */
+    unsigned char bufs[2][RECORD_BUFFER_SIZE];
+} cpool_recorder;
+
+#define CACHE_LINE 64
+#define CACHE_LINE_UP(size) (((size) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1))
+#define FC_SLOTS 32   /* publication slots of the combining engine */
+#define FC_SPINS 256  /* spins of a combining producer on its slot, before blocking on the mutex */
+
+/* states of a publication slot */
+enum { FC_FREE, FC_CLAIMED, FC_PENDING, FC_DONE, FC_REJECTED };
+
+/* Publication slot of the combining engine, aligned and padded to cache lines, so that slots share none,
+ * nor with the other members of the pool, which is allocated aligned to a cache line
+ */
+typedef union {
+    _Alignas(CACHE_LINE) struct {
+        atomic_int state;
+        cpool_work job;
+    } req;
+    char pad[2 * CACHE_LINE];
+} cpool_fc_slot;
+
+_Static_assert(sizeof(cpool_fc_slot) == 2 * CACHE_LINE && _Alignof(cpool_fc_slot) == CACHE_LINE,
+               "cpool_fc_slot is not aligned to cache lines");
+
+#define PERCPU_SHARDS 64 /* maximum number of shards of the per-CPU engine, CPUs beyond share them */
+#define PERCPU_SLOTS 16  /* jobs per shard */
+
+typedef struct {
+    atomic_flag lock;
+    atomic_int nonempty;   /* whether the shard holds jobs, read by workers without the shard lock */
+    unsigned first, count; /* ring of `jobs` */
+    cpool_work jobs[PERCPU_SLOTS];
+} cpool_shard_jobs;
+
+/* Shard of the per-CPU engine, aligned and padded to cache lines, so that shards share none */
+typedef union {
+    _Alignas(CACHE_LINE) cpool_shard_jobs s;
+    char pad[CACHE_LINE_UP(sizeof(cpool_shard_jobs))];
+} cpool_shard;
+
+_Static_assert(_Alignof(cpool_shard) == CACHE_LINE, "cpool_shard is not aligned to cache lines");
+
+#define DOMAINS_MAX 64   /* cache domains of the topology, more disable partitioning */
+#define DOMAIN_CPUS 1024 /* CPUs mapped to cache domains, others are in domain 0 */
+
+/* Cache topology: CPUs sharing a last-level (L3) cache, e.g. an AMD CCX, form a domain.
+ * Read once per process, see topology_read().
+ */
+typedef struct {
+    size_t nb_domains;   /* 0 if unknown, or a single domain */
+    size_t nb_cpus;
+    unsigned char cpu_domain[DOMAIN_CPUS];
+    unsigned char order[DOMAINS_MAX][DOMAINS_MAX]; /* other domains of each domain, by distance */
+} cpool_topology;
+
+/* A block of pool-owned memory, optionally backed by huge pages. */
 typedef struct {
-    cpool_func_t func;
-    void* data;
-    // cpool_work_clean_func clean_func;
-    cpool_future* future; /* Worker-side reference to the allocated future object.
-                           * The other side is hold by the user.
-                           */
-} cpool_work;
+    void* ptr;
+    size_t size;   /* mapped size, 0 if allocated with aligned_alloc() */
+} cpool_region;
 
 struct cpool {
-    thrd_t* workers;     /* Allocated array of thread identifiers. Joined on destruction. */
-    size_t nb_workers;
+    /* first, in the layout of cpool_inline_pool_, for the inline cpool_enqueue_node() */
+    atomic_int stop; /* written under the lock, also read without it by enqueues, see pool_stopped() */
+    _Atomic(cpool_node*) nodes_in;
+    atomic_size_t nb_parked;
+    atomic_int asym_fence; /* whether parked-worker handshakes currently use membarrier(), see fence_heavy() */
+    atomic_int nodes_used; /* set once, under the lock, before the first cpool_enqueue_node(), see fence_heavy() */
 
-    cpool_work* jobs;    /* ring buffer of jobs */
-    size_t max_jobs;     /* max size of the ring buffer */
-    size_t job_first, job_count;
+    int allocated;         /* whether the pool, workers and name are allocated, or in caller memory */
+    cpool_worker* workers; /* Array of workers. Joined on destruction. */
+    size_t nb_workers;     /* workers serving the queue, including replacements */
+    size_t nb_threads;     /* worker threads launched. Only modified by create and the watchdog. */
+    size_t max_threads;    /* capacity of `workers`: `nb_workers` plus allowed replacements */
+    size_t nb_started;     /* worker threads which have started up */
+    char* name;            /* pool name, may be NULL */
+
+    cpool_queue jobs;    /* bounded job queue, unused (without storage) with a custom scheduler */
+    const cpool_scheduler_ops* sched_ops; /* custom scheduler, or NULL */
+    void* sched;
+    cpool_region jobs_region;
+    /* Cache domains: with `nb_domains`, jobs are queued in `domain_jobs`, one queue per domain of the topology,
+     * and `jobs` only holds their storage and total count.
+     */
+    size_t nb_domains;   /* 0 if the queue is not partitioned */
+    cpool_queue domain_jobs[DOMAINS_MAX];
+    unsigned char worker_domains[DOMAINS_MAX]; /* domains with CPUs in `cpus_allowed`, served by workers */
+    size_t nb_worker_domains;                  /* 0 if workers are not assigned to domains */
+#ifdef __linux__
+    cpu_set_t cpus_allowed;  /* affinity of the creating thread, inherited by workers */
+#endif
 
     mtx_t mutex;
-    cnd_t cond, cond_enqueue, cond_idle;
+    cnd_t cond_enqueue, cond_idle;
     size_t nb_working;
-    int stop;
+    /* Parked workers, a LIFO stack: the most recently parked worker, whose caches are still warm, is woken
+     * first, and light load is served by few workers, letting the others stay asleep in deep C-states.
+     */
+    cpool_worker* idle_head;
+#ifdef CPOOL_HAVE_FUTEX
+    atomic_uint park_all;    /* futex word, bumped by park_wake_all() if `park_waitv` */
+    int park_waitv;          /* whether futex_waitv() is available */
+#endif
+
+    /* Intrusive nodes of cpool_enqueue_node(): pushed lock-free onto `nodes_in`, a LIFO stack,
+     * then taken in batches by workers into the FIFO `nodes_head`..`nodes_tail`, under the lock.
+     * Producers only take the lock to wake a worker, if `nb_parked` shows one may be waiting.
+     */
+    cpool_node* nodes_head;
+    cpool_node* nodes_tail;
+    int nodes_turn;                 /* alternates between nodes and queued jobs, so neither starves the other */
+
+    /* Fences of the parked-worker handshake, see fence_heavy() */
+    int asym_supported;             /* whether membarrier() is available */
+    size_t fence_jobs;              /* jobs from lock-free producers taken since the last park */
+    size_t fence_jobs_avg;          /* moving average of `fence_jobs` at parks */
+
+    /* combining engine */
+    cpool_engine engine;
+    atomic_int fc_active;           /* whether enqueues use the combining engine, switched by the adaptive engine */
+    int contention_rate;            /* adaptive engine: moving average of contended enqueues, in 1/1024 */
+    atomic_size_t fc_pending;       /* published requests, so that lock holders skip the scan if 0 */
+    cpool_fc_slot fc_slots[FC_SLOTS];
+
+    /* Per-CPU engine. The queue has room for `jobs_limit` enqueued jobs, plus the content of every shard,
+     * so that shards are always moved to the queue in full.
+     */
+    cpool_shard* shards;
+    size_t nb_shards;               /* 0 without the per-CPU engine */
+    size_t jobs_limit;              /* `max_jobs` */
+    size_t nb_drain_waiters;        /* cpool_wait_submitted() calls waiting for the queue to be within `jobs_limit` */
+
+    /* Submission epochs, for cpool_wait_submitted(). Jobs count as pending in the epoch they were
+     * enqueued in, by parity: only the current epoch and the previous one may have pending jobs.
+     */
+    uint64_t epoch;          /* current epoch, starting at 1 */
+    uint64_t epoch_done;     /* watermark: all jobs of this epoch and earlier ones are completed */
+    size_t epoch_pending[2];
+
+    cpool_stats stats;
+#ifdef CPOOL_PROFILE_CONTENTION
+    cpool_contention contention;
+#endif
+
+    /* workload recording, not under the pool mutex, see record_job() */
+    mtx_t record_mutex;
+    _Atomic(cpool_recorder*) recorder; /* active workload recorder, or NULL. Written under `record_mutex`. */
+
+    /* worker scheduling */
+    cpool_sched_policy sched_policy;
+    int sched_priority, sched_nice;
+
+    /* watchdog */
+    thrd_t watchdog;
+    int has_watchdog;
+    cnd_t cond_watchdog;
+    uint64_t watchdog_threshold_ns, watchdog_interval_ns;
+    cpool_watchdog_func_t watchdog_func;
+    void* watchdog_arg;
 };
 
-static int
-thread_func(void* pool_ptr)
+_Static_assert(offsetof(struct cpool, stop) == offsetof(cpool_inline_pool_, stop)
+               && offsetof(struct cpool, nodes_in) == offsetof(cpool_inline_pool_, nodes_in)
+               && offsetof(struct cpool, nb_parked) == offsetof(cpool_inline_pool_, nb_parked)
+               && offsetof(struct cpool, asym_fence) == offsetof(cpool_inline_pool_, asym_fence)
+               && offsetof(struct cpool, nodes_used) == offsetof(cpool_inline_pool_, nodes_used),
+               "struct cpool does not start with the layout of cpool_inline_pool_");
+_Static_assert(offsetof(struct cpool_future, flag) == offsetof(cpool_inline_future_, flag),
+               "struct cpool_future does not start with the layout of cpool_inline_future_");
+
+static uint64_t
+now_ns(void)
 {
-    cpool* pool = pool_ptr;
-    for (;;) {
-        cpool_func_t job_func;
-        void* job_data;
-        cpool_future* future;
-        {
-            mtx_lock(&pool->mutex);
-            while (pool->job_count == 0 && !pool->stop) {
-                cnd_wait(&pool->cond, &pool->mutex);
-            }
-            if (pool->stop && pool->job_count == 0) {
-                mtx_unlock(&pool->mutex);
-                return 0;
-            }
-            /* get a job from front */
-            cpool_work* job_front = pool->jobs + pool->job_first;
-            job_func = job_front->func;
-            job_data = job_front->data;
-            future   = job_front->future;
-            pool->job_first = (pool->job_first + 1) % pool->max_jobs;
-            pool->job_count -= 1;
-            pool->nb_working += 1;
-            mtx_unlock(&pool->mutex);
-        }
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
 
-        cnd_signal(&pool->cond_enqueue);
+static void
+hist_add(cpool_hist* hist, uint64_t ns)
+{
+    size_t i = 0;
+    while (i < HIST_BUCKETS - 1 && ns > hist_bounds[i]) ++i;
+    hist->count[i] += 1;
+    hist->sum_ns += ns;
+}
 
-        job_func(job_data);
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+#ifdef MAP_HUGETLB
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+/* MAP_HUGE_2MB: explicit huge pages of HUGE_PAGE_SIZE, which mappings are rounded to, rather than of the default
+ * size of the system, e.g. 1 GiB, with which mmap() and munmap() of a rounded size fail.
+ */
+#define HUGE_PAGE_MAP_SIZE (21 << MAP_HUGE_SHIFT)
+#endif
 
-        if (future) {
-            mtx_lock(&future->mutex);
-            future->flag = 1;
-            mtx_unlock(&future->mutex);
-            cnd_signal(&future->cond); // only one thread is allowed to wait on the future...
+/* Allocate `size` bytes of pool memory, aligned to a cache line, backed by huge pages as requested by `mode`.
+ * Falls back to transparent huge pages, then to aligned_alloc(), if huge pages are not available.
+ */
+static int
+region_alloc(cpool_region* region, size_t size, cpool_hugepages mode)
+{
+    region->size = 0;
+#ifdef __linux__
+    size_t rounded = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+    if (mode == CPOOL_HUGEPAGES_HUGETLB) {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | HUGE_PAGE_MAP_SIZE;
+        void* ptr = mmap(NULL, rounded, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (ptr != MAP_FAILED) {
+            region->ptr  = ptr;
+            region->size = rounded;
+            return 0;
         }
-
-        {
-            mtx_lock(&pool->mutex);
-            if (--pool->nb_working == 0 && pool->job_count == 0) cnd_broadcast(&pool->cond_idle);
-            mtx_unlock(&pool->mutex);
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    if (mode != CPOOL_HUGEPAGES_NONE) {
+        /* over-allocate, to trim to a huge page aligned range that THP can back */
+        size_t mapped = rounded + HUGE_PAGE_SIZE;
+        char* ptr = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr != MAP_FAILED) {
+            char* aligned = (char*)(((uintptr_t)ptr + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+            if (aligned != ptr) munmap(ptr, (size_t)(aligned - ptr));
+            if (aligned + rounded != ptr + mapped) munmap(aligned + rounded, (size_t)(ptr + mapped - aligned - rounded));
+            madvise(aligned, rounded, MADV_HUGEPAGE);
+            region->ptr  = aligned;
+            region->size = rounded;
+            return 0;
         }
     }
+#endif
+#endif
+    (void)mode;
+    region->ptr = aligned_alloc(CACHE_LINE, CACHE_LINE_UP(size));
+    return region->ptr == NULL;
 }
 
-cpool*
-cpool_create(size_t nb_workers, size_t max_jobs)
+static void
+region_free(cpool_region* region)
 {
-    cpool* pool = NULL;
-    if (!nb_workers || !max_jobs) goto end;
+#ifdef __linux__
+    if (region->size) {
+        munmap(region->ptr, region->size);
+        return;
+    }
+#endif
+    free(region->ptr);
+}
 
-    pool = malloc(sizeof(cpool));
-    if (!pool) goto end;
-    pool->nb_workers = nb_workers;
-    pool->max_jobs   = max_jobs;
-    pool->job_first  = 0;
-    pool->job_count  = 0;
-    pool->nb_working = 0;
-    pool->stop       = 0;
-
-    if (!(pool->workers = malloc(sizeof(thrd_t) * nb_workers))) goto workers_fail;
-    if (!(pool->jobs = malloc(sizeof(cpool_work) * max_jobs)))  goto jobs_fail;
-    if (mtx_init(&pool->mutex, mtx_plain) != thrd_success)      goto mutex_fail;
-    if (cnd_init(&pool->cond)             != thrd_success)      goto cond_fail;
-    if (cnd_init(&pool->cond_enqueue)     != thrd_success)      goto cond_enqueue_fail;
-    if (cnd_init(&pool->cond_idle)        != thrd_success)      goto cond_idle_fail;
+/* ID of the calling thread for workload recording, assigned on first enqueue. */
+static _Thread_local uint32_t submitter_id;
+static atomic_uint next_submitter_id = 1;
 
-    /* launch workers */
-    size_t thread_success_count = 0;
-    for (size_t i = 0; i < nb_workers; ++i) {
-        if (thrd_create(pool->workers + i, thread_func, pool) == thrd_success) {
-            ++thread_success_count;
-        }
-        else break;
+static uint32_t
+current_submitter(void)
+{
+    if (!submitter_id) submitter_id = atomic_fetch_add_explicit(&next_submitter_id, 1, memory_order_relaxed);
+    return submitter_id;
+}
+
+static void
+put_le(unsigned char* dst, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) dst[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint64_t
+get_le(const unsigned char* src, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i) value |= (uint64_t)src[i] << (8 * i);
+    return value;
+}
+
+/* Write out `len` bytes of records. Called with `write_mutex` held. */
+static void
+recorder_write(cpool_recorder* rec, const unsigned char* buf, size_t len)
+{
+    if (len && fwrite(buf, 1, len, rec->out) != len) rec->error = 1;
+}
+
+/* Record a completed job enqueued at `enqueue_ns`, if the pool is recording.
+ * Records are appended under `record_mutex`, not the pool mutex, and a full buffer is swapped with the spare
+ * one and written out after unlocking, under `write_mutex` only, so that a slow output only holds up workers
+ * recording jobs, and not the enqueues and dequeues of the pool. `write_mutex` is taken before unlocking,
+ * which waits for the spare buffer to be written, and keeps the recorder alive until cpool_record_stop().
+ */
+static void
+record_job(cpool* pool, cpool_record* record, uint64_t enqueue_ns)
+{
+    if (!atomic_load_explicit(&pool->recorder, memory_order_relaxed)) return;
+    mtx_lock(&pool->record_mutex);
+    cpool_recorder* rec = atomic_load_explicit(&pool->recorder, memory_order_relaxed);
+    if (!rec || enqueue_ns < rec->start_ns) {
+        mtx_unlock(&pool->record_mutex);
+        return;
     }
-    /* clean up threads in case of failure */
-    if (thread_success_count == nb_workers) goto end;
-    {
+    record->enqueue_ns = enqueue_ns - rec->start_ns;
+    unsigned char* dst = rec->buf + rec->len;
+    put_le(dst,      record->enqueue_ns, 8);
+    put_le(dst +  8, record->wait_ns,    8);
+    put_le(dst + 16, record->run_ns,     8);
+    put_le(dst + 24, record->func,       8);
+    put_le(dst + 32, record->thread,     4);
+    put_le(dst + 36, record->worker,     4);
+    rec->len += RECORD_SIZE;
+    if (rec->len < RECORD_BUFFER_SIZE) {
+        mtx_unlock(&pool->record_mutex);
+        return;
+    }
+    unsigned char* full = rec->buf;
+    mtx_lock(&rec->write_mutex);
+    rec->buf   = rec->spare;
+    rec->spare = full;
+    rec->len   = 0;
+    mtx_unlock(&pool->record_mutex);
+    recorder_write(rec, full, RECORD_BUFFER_SIZE);
+    mtx_unlock(&rec->write_mutex);
+}
+
+#define PREFETCH_MAX  4096   /* bytes of a prefetched range */
+#define PREFETCH_FUNC 0xffff /* `prefetch_len` of a job with a prefetch callback */
+
+_Static_assert(PREFETCH_MAX < PREFETCH_FUNC, "prefetched ranges do not fit in prefetch_len");
+_Static_assert(sizeof(void*) != 8 || sizeof(cpool_work) == CACHE_LINE, "a queued job does not fit a cache line");
+
+/* Descriptor of the data to prefetch for `job`, unpacked, see cpool_enqueue_prefetch(). */
+static cpool_prefetch
+job_prefetch_get(const cpool_work* job)
+{
+    cpool_prefetch prefetch = { .addr = NULL, .len = 0, .func = NULL };
+    if (job->prefetch_len == PREFETCH_FUNC) {
+        prefetch.func = job->prefetch.func;
+    } else if (job->prefetch_len) {
+        prefetch.addr = job->prefetch.addr;
+        prefetch.len  = job->prefetch_len;
+    }
+    return prefetch;
+}
+
+/* Prefetch the data of a job, into all cache levels if it is about to run on this worker (`own`),
+ * or only into the outer levels, shared with the other workers, if it may be taken by another.
+ * The callback is only called for the worker's own job: another job may run on another worker meanwhile,
+ * and free its data, and only prefetching its range is safe then.
+ */
+static void
+job_prefetch(const cpool_prefetch* prefetch, void* data, int own)
+{
+    if (own && prefetch->func) {
+        prefetch->func(data);
+        return;
+    }
+#ifdef __GNUC__
+    const char* addr = prefetch->addr;
+    for (size_t off = 0; off < prefetch->len; off += CACHE_LINE) {
+        if (own) __builtin_prefetch(addr + off, 0, 3);
+        else     __builtin_prefetch(addr + off, 0, 1);
+    }
+#else
+    (void)own;
+#endif
+}
+
+/* Acquire the pool mutex. With CPOOL_PROFILE_CONTENTION, acquisitions are counted per call site,
+ * and a failed try-lock is counted as contended, timing the blocking lock that follows.
+ */
+static inline void
+pool_lock(cpool* pool, cpool_site site)
+{
+#ifdef CPOOL_PROFILE_CONTENTION
+    if (mtx_trylock(&pool->mutex) != thrd_success) {
+        uint64_t start = now_ns();
         mtx_lock(&pool->mutex);
-        pool->stop = 1;
-        mtx_unlock(&pool->mutex);
+        pool->contention.site[site].contended += 1;
+        pool->contention.site[site].wait_ns += now_ns() - start;
     }
-    cnd_broadcast(&pool->cond);
-    for (size_t i = 0; i < thread_success_count; ++i) {
-        thrd_join(pool->workers[i], NULL);
+    pool->contention.site[site].acquired += 1;
+#else
+    (void)site;
+    mtx_lock(&pool->mutex);
+#endif
+}
+
+/* Try to acquire the pool mutex, without blocking. Returns 0 on success, counted as an acquisition of `site`
+ * with CPOOL_PROFILE_CONTENTION, and 1 if the mutex is taken, which is not counted, as callers do something
+ * else than waiting for it then.
+ */
+static inline int
+pool_trylock(cpool* pool, cpool_site site)
+{
+    if (mtx_trylock(&pool->mutex) != thrd_success) return 1;
+#ifdef CPOOL_PROFILE_CONTENTION
+    pool->contention.site[site].acquired += 1;
+#else
+    (void)site;
+#endif
+    return 0;
+}
+
+/* Same as pool_lock(), returning whether the mutex was taken by another thread. */
+static inline int
+pool_lock_probe(cpool* pool, cpool_site site)
+{
+    if (pool_trylock(pool, site) == 0) return 0;
+#ifdef CPOOL_PROFILE_CONTENTION
+    uint64_t start = now_ns();
+    mtx_lock(&pool->mutex);
+    pool->contention.site[site].contended += 1;
+    pool->contention.site[site].wait_ns += now_ns() - start;
+    pool->contention.site[site].acquired += 1;
+#else
+    (void)site;
+    mtx_lock(&pool->mutex);
+#endif
+    return 1;
+}
+
+/* Wait on one of the pool condition variables. The pool mutex must be held.
+ * With CPOOL_PROFILE_CONTENTION, time spent waiting (including re-acquiring the mutex) is accounted to `id`.
+ */
+static inline void
+pool_wait(cpool* pool, cnd_t* cond, cpool_cond id)
+{
+#ifdef CPOOL_PROFILE_CONTENTION
+    uint64_t start = now_ns();
+    cnd_wait(cond, &pool->mutex);
+    pool->contention.cond[id].waits += 1;
+    pool->contention.cond[id].wait_ns += now_ns() - start;
+#else
+    (void)id;
+    cnd_wait(cond, &pool->mutex);
+#endif
+}
+
+/* Whether the pool is stopped. The flag is written once, under the lock: reads under the lock are ordered by
+ * it, and enqueues checking it without the lock only need some recent value, the lock decides.
+ */
+static inline int
+pool_stopped(const cpool* pool)
+{
+    return atomic_load_explicit(&pool->stop, memory_order_relaxed);
+}
+
+/* Asymmetric fences of the parked-worker handshake: producers enqueuing without the lock publish their job,
+ * then read `nb_parked`, while parking workers increment `nb_parked`, then look for such jobs once more.
+ * Each side needs a full fence between its write and its read, but producers pass it on every enqueue,
+ * and workers only when about to sleep. With membarrier(2) (Linux 4.14), producers only issue a compiler
+ * barrier, fence_light(), and parking workers, in fence_heavy(), have the kernel run a full fence on every
+ * running thread of the process, so that producers' accesses are ordered whenever they matter.
+ * Without it, both sides issue a standard full fence.
+ */
+#ifdef CPOOL_HAVE_MEMBARRIER
+/* Whether private expedited membarrier() is available, probed and registered for once per process. */
+static int
+membarrier_supported(void)
+{
+    static atomic_int supported = -1;
+    int result = atomic_load_explicit(&supported, memory_order_relaxed);
+    if (result < 0) {
+        long cmds = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+        result = cmds > 0 && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+                 && syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+        atomic_store_explicit(&supported, result, memory_order_relaxed);
     }
+    return result;
+}
+#endif
 
-    cnd_destroy(&pool->cond_idle);
-cond_idle_fail:
-    cnd_destroy(&pool->cond_enqueue);
-cond_enqueue_fail:
-    cnd_destroy(&pool->cond);
-cond_fail:
-    mtx_destroy(&pool->mutex);
-mutex_fail:
-    free(pool->jobs);
-jobs_fail:
-    free(pool->workers);
-workers_fail:
-    free(pool);
-    pool = NULL;
-end:
-    return pool;
+/* Light side, for a producer which published its job. `asym_fence` is read after publishing, see fence_adapt(). */
+static inline void
+fence_light(const cpool* pool)
+{
+    if (atomic_load_explicit(&pool->asym_fence, memory_order_acquire)) atomic_signal_fence(memory_order_seq_cst);
+    else atomic_thread_fence(memory_order_seq_cst);
 }
 
-void
-cpool_destroy(cpool* pool)
+#define FENCE_WEIGHT     16  /* inverse weight of a park in `fence_jobs_avg` */
+#define FENCE_SYM_BELOW  32  /* switch to symmetric fences below this many lock-free jobs per park... */
+#define FENCE_ASYM_ABOVE 256 /* ...and back to membarrier() above this many, so as not to flip-flop */
+#define FENCE_JOBS_MAX   4096
+
+/* Choose the fences of the handshake at a park, with the lock held. Returns whether to issue membarrier().
+ * Parks are not always rare: under light load, workers park after about every job, and membarrier() costs
+ * a system call and an interrupt of every CPU running a thread of the process. When parks take few jobs
+ * of lock-free producers on average, producers switch to a full fence per enqueue instead, until parks
+ * take many again.
+ * Producers read `asym_fence` after publishing their job. Switching to symmetric fences issues a last
+ * membarrier() with the lock held: producers which read the old value have published their job by then,
+ * and the caller takes it. Switching back is done with the lock held, which symmetric workers hold from
+ * their increment of `nb_parked` to sleeping, so producers which read the new value see the increment.
+ */
+#ifdef CPOOL_HAVE_MEMBARRIER
+static int
+fence_adapt(cpool* pool)
 {
-    cpool_stop(pool);
-    for (size_t i = 0; i < pool->nb_workers; ++i) {
-        thrd_join(pool->workers[i], NULL);
+    size_t jobs = pool->fence_jobs < FENCE_JOBS_MAX ? pool->fence_jobs : FENCE_JOBS_MAX;
+    pool->fence_jobs = 0;
+    if (jobs > pool->fence_jobs_avg) pool->fence_jobs_avg += (jobs - pool->fence_jobs_avg) / FENCE_WEIGHT;
+    else                             pool->fence_jobs_avg -= (pool->fence_jobs_avg - jobs) / FENCE_WEIGHT;
+    int asym = atomic_load_explicit(&pool->asym_fence, memory_order_relaxed);
+    if (asym && pool->fence_jobs_avg < FENCE_SYM_BELOW) {
+        atomic_store_explicit(&pool->asym_fence, 0, memory_order_relaxed);
+        /* cannot fail once registered */
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+        pool->stats.nb_membarriers += 1;
+        pool->stats.nb_fence_switches += 1;
+        return 0;
     }
-    cnd_destroy(&pool->cond_idle);
-    cnd_destroy(&pool->cond_enqueue);
-    cnd_destroy(&pool->cond);
-    mtx_destroy(&pool->mutex);
-    free(pool->jobs);
-    free(pool->workers);
-    free(pool);
+    if (!asym && pool->fence_jobs_avg > FENCE_ASYM_ABOVE) {
+        atomic_store_explicit(&pool->asym_fence, 1, memory_order_release);
+        pool->stats.nb_fence_switches += 1;
+        return 1;
+    }
+    return asym;
 }
+#endif
 
-int
-cpool_enqueue(cpool* pool, cpool_func_t func, void* data, cpool_future** future)
+/* Heavy side, for a worker about to park, with the lock held. membarrier() is only issued once lock-free
+ * producers may exist, i.e. with the per-CPU engine or once nodes were enqueued, while parks are rare enough,
+ * see fence_adapt(), and with the lock released, not to hold up the enqueues and dequeues of the pool meanwhile.
+ * Producers mark nodes as used under the lock: a worker which saw them unused, under the lock, is either
+ * parked or has incremented `nb_parked` before the first node producer takes the lock.
+ * Returns 1 if the lock was released, for the caller to check for work again.
+ */
+static int
+fence_heavy(cpool* pool)
 {
-    if (future) *future = cpool_future_create();
-    {
-        mtx_lock(&pool->mutex);
-        while (pool->job_count == pool->max_jobs && !pool->stop) {
-            cnd_wait(&pool->cond_enqueue, &pool->mutex);
-        }
-        if (pool->stop) {
-            mtx_unlock(&pool->mutex);
-            if (future && *future) {
-                cpool_future_destroy(*future);
-                *future = NULL;
-            }
-            return 1;
-        }
-        /* push back work */
-        cpool_work* job_new = pool->jobs + (pool->job_first + pool->job_count) % pool->max_jobs;
-        job_new->func = func;
-        job_new->data = data;
-        job_new->future = future? *future : NULL;
-        pool->job_count += 1;
+#ifdef CPOOL_HAVE_MEMBARRIER
+    if (pool->asym_supported && (pool->nb_shards || atomic_load_explicit(&pool->nodes_used, memory_order_relaxed))
+        && fence_adapt(pool)) {
+        pool->stats.nb_membarriers += 1;
         mtx_unlock(&pool->mutex);
+        /* cannot fail once registered */
+        if (syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0) != 0) atomic_thread_fence(memory_order_seq_cst);
+        pool_lock(pool, CPOOL_SITE_DEQUEUE);
+        return 1;
     }
-    cnd_signal(&pool->cond);
+#else
+    (void)pool;
+#endif
+    atomic_thread_fence(memory_order_seq_cst);
     return 0;
 }
 
-void
-cpool_stop(cpool* pool)
+/* Worker parking. A parked worker is on the idle list of the pool, and sleeps in park_wait() until it is
+ * taken off the list and woken with park_wake(), or until park_wake_all().
+ * On Linux, workers sleep on futexes, without going through a condition variable and its internal lock.
+ * With futex_waitv() (Linux 5.16), a worker waits on both its own word, for targeted wakeups, and the
+ * `park_all` word of the pool, so that park_wake_all() wakes every parked worker with one system call.
+ * Older kernels fall back to waiting on the own word only, used as an eventcount, and park_wake_all()
+ * wakes parked workers one by one. Elsewhere, each worker waits on its own condition variable.
+ */
+#ifdef CPOOL_HAVE_FUTEX
+
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+#define PARK_WAITV_FLAGS (2 | FUTEX_PRIVATE_FLAG) /* FUTEX2_SIZE_U32 | FUTEX2_PRIVATE */
+
+/* struct futex_waitv, missing from older kernel headers */
+typedef struct {
+    uint64_t val;
+    uint64_t uaddr;
+    uint32_t flags;
+    uint32_t reserved;
+} park_waiter;
+
+static long
+futex_waitv(park_waiter* waiters, unsigned nb_waiters)
 {
-    {
-        mtx_lock(&pool->mutex);
-        pool->stop = 1;
-        mtx_unlock(&pool->mutex);
+    return syscall(SYS_futex_waitv, waiters, nb_waiters, 0, NULL, 0);
+}
+
+/* Whether futex_waitv() is available, probed once: it fails with EAGAIN on a word not holding the
+ * expected value, and with ENOSYS on older kernels.
+ */
+static int
+futex_waitv_supported(void)
+{
+    static atomic_int supported = -1;
+    int result = atomic_load_explicit(&supported, memory_order_relaxed);
+    if (result < 0) {
+        atomic_uint word = 1;
+        park_waiter waiter = { .val = 0, .uaddr = (uintptr_t)&word, .flags = PARK_WAITV_FLAGS };
+        result = futex_waitv(&waiter, 1) < 0 && errno == EAGAIN;
+        atomic_store_explicit(&supported, result, memory_order_relaxed);
     }
-    cnd_broadcast(&pool->cond);
-    cnd_broadcast(&pool->cond_enqueue);
+    return result;
 }
+#endif
 
-void
-cpool_wait(cpool* pool)
+static int
+park_init(cpool_worker* worker)
+{
+#ifdef CPOOL_HAVE_FUTEX
+    atomic_init(&worker->park_word, 0);
+    return 0;
+#else
+    return cnd_init(&worker->cond) != thrd_success;
+#endif
+}
+
+static void
+park_destroy(cpool_worker* worker)
+{
+#ifdef CPOOL_HAVE_FUTEX
+    (void)worker;
+#else
+    cnd_destroy(&worker->cond);
+#endif
+}
+
+/* Sleep until woken, or spuriously. Called with the lock held, by a worker on the idle list. */
+static void
+park_wait(cpool* pool, cpool_worker* worker)
 {
+#ifdef CPOOL_HAVE_FUTEX
+    /* Read under the lock: a wakeup after unlocking changes a word, and the wait returns at once. */
+    unsigned own = atomic_load_explicit(&worker->park_word, memory_order_relaxed);
+    unsigned all = atomic_load_explicit(&pool->park_all, memory_order_relaxed);
+#ifdef CPOOL_PROFILE_CONTENTION
+    uint64_t start = now_ns();
+#endif
+    mtx_unlock(&pool->mutex);
+    if (pool->park_waitv) {
+        park_waiter waiters[2] = {
+            { .val = own, .uaddr = (uintptr_t)&worker->park_word, .flags = PARK_WAITV_FLAGS },
+            { .val = all, .uaddr = (uintptr_t)&pool->park_all,    .flags = PARK_WAITV_FLAGS },
+        };
+        futex_waitv(waiters, 2);
+    } else {
+        syscall(SYS_futex, &worker->park_word, FUTEX_WAIT_PRIVATE, own, NULL, NULL, 0);
+    }
     mtx_lock(&pool->mutex);
-    while (pool->nb_working > 0 || pool->job_count > 0) {
-        cnd_wait(&pool->cond_idle, &pool->mutex);
+#ifdef CPOOL_PROFILE_CONTENTION
+    pool->contention.cond[CPOOL_COND_WORK].waits += 1;
+    pool->contention.cond[CPOOL_COND_WORK].wait_ns += now_ns() - start;
+#endif
+#else
+    pool_wait(pool, &worker->cond, CPOOL_COND_WORK);
+#endif
+}
+
+/* Wake `worker`, taken off the idle list. Preferably called after unlocking. */
+static void
+park_wake(cpool_worker* worker)
+{
+#ifdef CPOOL_HAVE_FUTEX
+    atomic_fetch_add_explicit(&worker->park_word, 1, memory_order_relaxed);
+    syscall(SYS_futex, &worker->park_word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    cnd_signal(&worker->cond);
+#endif
+}
+
+/* Apply the scheduling attributes of the pool to the calling worker.
+ * Failures, e.g. lacking privileges for a realtime policy, leave the inherited settings in place.
+ */
+static void
+worker_apply_sched(const cpool* pool)
+{
+#ifdef CPOOL_HAVE_PTHREAD
+    int policy = -1;
+    switch (pool->sched_policy) {
+    case CPOOL_SCHED_INHERIT: break;
+    case CPOOL_SCHED_OTHER:   policy = SCHED_OTHER; break;
+#ifdef SCHED_BATCH
+    case CPOOL_SCHED_BATCH:   policy = SCHED_BATCH; break;
+#endif
+#ifdef SCHED_IDLE
+    case CPOOL_SCHED_IDLE:    policy = SCHED_IDLE;  break;
+#endif
+    case CPOOL_SCHED_FIFO:    policy = SCHED_FIFO;  break;
+    case CPOOL_SCHED_RR:      policy = SCHED_RR;    break;
+    default: break;
     }
-    mtx_unlock(&pool->mutex);
+    if (policy != -1) {
+        struct sched_param param = { .sched_priority = 0 };
+        if (policy == SCHED_FIFO || policy == SCHED_RR) {
+            int lo = sched_get_priority_min(policy), hi = sched_get_priority_max(policy);
+            param.sched_priority = pool->sched_priority < lo ? lo
+                                 : pool->sched_priority > hi ? hi : pool->sched_priority;
+        }
+        pthread_setschedparam(pthread_self(), policy, &param);
+    }
+#endif
+#ifdef __linux__
+    /* On Linux, the nice value is per-thread. */
+    if (pool->sched_nice) setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), pool->sched_nice);
+#endif
+    (void)pool;
 }
 
-void
-cpool_wait_future(cpool_future* future)
+/* Name the calling worker "<pool>-<index>", truncated to fit the OS limit by shortening the pool name. */
+static void
+worker_set_name(const cpool_worker* worker)
 {
-    {
-        mtx_lock(&future->mutex);
-        while (!future->flag) {
-            cnd_wait(&future->cond, &future->mutex);
+#if defined(__linux__) || defined(__APPLE__)
+    const cpool* pool = worker->pool;
+    if (!pool->name) return;
+    char name[16]; /* limit on Linux, including null terminator */
+    char suffix[sizeof(name)];
+    size_t suffix_len = (size_t)snprintf(suffix, sizeof(suffix), "-%zu", worker->index);
+    size_t prefix_len = strlen(pool->name);
+    if (suffix_len >= sizeof(suffix)) suffix_len = sizeof(suffix) - 1;
+    if (prefix_len > sizeof(name) - 1 - suffix_len) prefix_len = sizeof(name) - 1 - suffix_len;
+    memcpy(name, pool->name, prefix_len);
+    memcpy(name + prefix_len, suffix, suffix_len + 1);
+#ifdef __linux__
+    pthread_setname_np(pthread_self(), name);
+#else
+    pthread_setname_np(name);
+#endif
+#else
+    (void)worker;
+#endif
+}
+
+static cpool_topology topology;
+static once_flag topology_once = ONCE_FLAG_INIT;
+
+#ifdef __linux__
+/* Read the first line of a sysfs file into `buf`, without the newline. Returns 0 on success. */
+static int
+sysfs_read(const char* path, char* buf, size_t size)
+{
+    FILE* file = fopen(path, "r");
+    if (!file) return 1;
+    int failed = !fgets(buf, (int)size, file);
+    fclose(file);
+    if (!failed) buf[strcspn(buf, "\n")] = '\0';
+    return failed;
+}
+
+/* Lowest CPU sharing the L3 cache of `cpu`, identifying its cache domain, or -1 if unknown. */
+static long
+cpu_l3_first(long cpu)
+{
+    char path[128], buf[64];
+    for (int index = 0; index < 16; ++index) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/cache/index%d/level", cpu, index);
+        if (sysfs_read(path, buf, sizeof(buf))) break;
+        if (strcmp(buf, "3")) continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/cache/index%d/shared_cpu_list", cpu, index);
+        return sysfs_read(path, buf, sizeof(buf)) ? -1 : strtol(buf, NULL, 10); /* e.g. "0-7,64-71" */
+    }
+    return -1;
+}
+
+/* Physical package (socket) of `cpu`, 0 if unknown. */
+static long
+cpu_package(long cpu)
+{
+    char path[128], buf[32];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/topology/physical_package_id", cpu);
+    return sysfs_read(path, buf, sizeof(buf)) ? 0 : strtol(buf, NULL, 10);
+}
+#endif
+
+/* Read the cache topology from sysfs, once per process (Linux only).
+ * The distance order of a domain starts with the domain itself, then lists the domains of the same package,
+ * then the remote ones, each rotated to start after the domain, so that the domains of a package
+ * spread their steals over different victims.
+ */
+static void
+topology_read(void)
+{
+#ifdef __linux__
+    long nb_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    long first[DOMAINS_MAX], package[DOMAINS_MAX];
+    size_t nb_domains = 0;
+    if (nb_cpus > DOMAIN_CPUS) nb_cpus = DOMAIN_CPUS;
+    for (long cpu = 0; cpu < nb_cpus; ++cpu) {
+        long cpu_first = cpu_l3_first(cpu);
+        size_t domain = 0; /* unknown, e.g. offline CPUs */
+        if (cpu_first >= 0) {
+            while (domain < nb_domains && first[domain] != cpu_first) ++domain;
+            if (domain == nb_domains) {
+                if (nb_domains == DOMAINS_MAX) return;
+                first[nb_domains]     = cpu_first;
+                package[nb_domains++] = cpu_package(cpu);
+            }
         }
-        mtx_unlock(&future->mutex);
+        topology.cpu_domain[cpu] = (unsigned char)domain;
     }
-    /* Following our assumptions, this should be the last reference to the future, so destroy it. */
-    cpool_future_destroy(future);
+    for (size_t domain = 0; domain < nb_domains; ++domain) {
+        unsigned char* order = topology.order[domain];
+        size_t n = 0;
+        order[n++] = (unsigned char)domain;
+        for (int remote = 0; remote <= 1; ++remote) {
+            for (size_t i = 1; i < nb_domains; ++i) {
+                size_t other = (domain + i) % nb_domains;
+                if ((package[other] != package[domain]) == remote) order[n++] = (unsigned char)other;
+            }
+        }
+    }
+    topology.nb_cpus    = nb_cpus < 0 ? 0 : (size_t)nb_cpus;
+    topology.nb_domains = nb_domains > 1 ? nb_domains : 0;
+#endif
+}
+
+/* Cache domain of the CPU the calling thread runs on. */
+static size_t
+current_domain(void)
+{
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && (size_t)cpu < topology.nb_cpus) return topology.cpu_domain[cpu];
+#endif
+    return 0;
+}
+
+/* Find the cache domains workers are assigned to: those with CPUs in the affinity of the creating thread,
+ * which workers inherit, e.g. from taskset(1). Workers are only restricted further within it.
+ */
+static void
+domains_assign(cpool* pool)
+{
+    pool->nb_worker_domains = 0;
+#ifdef __linux__
+    if (!pool->nb_domains) return;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(pool->cpus_allowed), &pool->cpus_allowed)) return;
+    int allowed[DOMAINS_MAX] = {0};
+    for (size_t cpu = 0; cpu < topology.nb_cpus && cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &pool->cpus_allowed)) allowed[topology.cpu_domain[cpu]] = 1;
+    }
+    for (size_t domain = 0; domain < pool->nb_domains; ++domain) {
+        if (allowed[domain]) pool->worker_domains[pool->nb_worker_domains++] = (unsigned char)domain;
+    }
+#endif
+}
+
+/* Restrict the calling worker to the allowed CPUs of its cache domain, where the jobs of its queue were enqueued. */
+static void
+worker_apply_domain(const cpool_worker* worker)
+{
+#ifdef __linux__
+    const cpool* pool = worker->pool;
+    if (!pool->nb_worker_domains) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t cpu = 0; cpu < topology.nb_cpus && cpu < CPU_SETSIZE; ++cpu) {
+        if (topology.cpu_domain[cpu] == worker->domain && CPU_ISSET(cpu, &pool->cpus_allowed)) CPU_SET(cpu, &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)worker;
+#endif
+}
+
+/* Push `job` onto the queue of the domain it was enqueued from, or of the nearest one with room.
+ * The queues have room for the whole capacity of the pool, so one of them has.
+ */
+static void
+domain_push(cpool* pool, const cpool_work* job)
+{
+    const unsigned char* order = topology.order[job->domain];
+    for (size_t i = 0; i < pool->nb_domains; ++i) {
+        cpool_queue* queue = pool->domain_jobs + order[i];
+        if (queue->count < queue->capacity) {
+            queue_push(queue, job);
+            break;
+        }
+    }
+    pool->jobs.count += 1;
+}
+
+/* Pop a job for a worker of `domain`: from the domain's queue, or from the nearest other one. */
+static void
+domain_pop(cpool* pool, size_t domain, cpool_work* job)
+{
+    const unsigned char* order = topology.order[domain];
+    for (size_t i = 0; i < pool->nb_domains; ++i) {
+        cpool_queue* queue = pool->domain_jobs + order[i];
+        if (queue->count) {
+            queue_pop(queue, job);
+            if (i) pool->stats.nb_steals += 1;
+            break;
+        }
+    }
+    pool->jobs.count -= 1;
+}
+
+/* Job queue operations, dispatching to the custom scheduler, or to cache domains, if any.
+ * Called with the lock held.
+ */
+
+static inline size_t
+pool_queued(const cpool* pool)
+{
+    return pool->sched_ops ? pool->sched_ops->size(pool->sched) : pool->jobs.count;
+}
+
+static inline void
+pool_push(cpool* pool, const cpool_work* job)
+{
+    if (pool->sched_ops) pool->sched_ops->push(pool->sched, job);
+    else if (pool->nb_domains) domain_push(pool, job);
+    else queue_push(&pool->jobs, job);
+}
+
+static void
+pool_push_batch(cpool* pool, const cpool_work* jobs, size_t nb_jobs)
+{
+    if (pool->sched_ops && pool->sched_ops->push_batch) {
+        pool->sched_ops->push_batch(pool->sched, jobs, nb_jobs);
+        return;
+    }
+    for (size_t i = 0; i < nb_jobs; ++i) pool_push(pool, jobs + i);
+}
+
+/* Pop the next job, for a worker of cache domain `domain`. */
+static inline void
+pool_pop(cpool* pool, size_t domain, cpool_work* job)
+{
+    if (pool->sched_ops) pool->sched_ops->pop(pool->sched, job);
+    else if (pool->nb_domains) domain_pop(pool, domain, job);
+    else queue_pop(&pool->jobs, job);
+}
+
+/* Next job to be popped by a worker of `domain`, or NULL if unknown, i.e. with a custom scheduler,
+ * or in another domain's queue.
+ */
+static inline const cpool_work*
+pool_peek(const cpool* pool, size_t domain)
+{
+    if (pool->sched_ops) return NULL;
+    const cpool_queue* queue = pool->nb_domains ? pool->domain_jobs + domain : &pool->jobs;
+    return queue->count ? queue_peek(queue) : NULL;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__) && defined(__GNUC__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+/* Apply the enqueues published in slots of the combining engine. Called with the lock held.
+ * Requests left pending when the queue is full are applied by a later combiner.
+ * Returns the number of jobs enqueued, for which workers have to be woken after unlocking.
+ */
+static size_t
+fc_combine(cpool* pool)
+{
+    if (!atomic_load_explicit(&pool->fc_pending, memory_order_acquire)) return 0;
+    cpool_work batch[FC_SLOTS];
+    cpool_fc_slot* served[FC_SLOTS];
+    size_t queued = pool_queued(pool);
+    size_t nb_enqueued = 0, room = queued < pool->jobs_limit ? pool->jobs_limit - queued : 0;
+    for (size_t i = 0; i < FC_SLOTS && nb_enqueued < room; ++i) {
+        cpool_fc_slot* slot = pool->fc_slots + i;
+        if (atomic_load_explicit(&slot->req.state, memory_order_acquire) != FC_PENDING) continue;
+        if (pool_stopped(pool)) {
+            atomic_fetch_sub_explicit(&pool->fc_pending, 1, memory_order_relaxed);
+            atomic_store_explicit(&slot->req.state, FC_REJECTED, memory_order_release);
+            continue;
+        }
+        cpool_work* job = batch + nb_enqueued;
+        *job = slot->req.job;
+        job->epoch = pool->epoch & 1;
+        pool->epoch_pending[job->epoch] += 1;
+        CPOOL_TRACE(enqueue, 4, pool, job->func, job->data, pool_queued(pool) + nb_enqueued + 1); /* pool, function, data, queue depth */
+        served[nb_enqueued++] = slot;
+    }
+    if (!nb_enqueued) return 0;
+    pool_push_batch(pool, batch, nb_enqueued);
+    pool->stats.nb_enqueued += nb_enqueued;
+    atomic_fetch_sub_explicit(&pool->fc_pending, nb_enqueued, memory_order_relaxed);
+    for (size_t i = 0; i < nb_enqueued; ++i) {
+        atomic_store_explicit(&served[i]->req.state, FC_DONE, memory_order_release);
+    }
+    return nb_enqueued;
+}
+
+#define ADAPT_WEIGHT 16  /* inverse weight of a sample in the contention rate */
+#define ADAPT_HIGH   512 /* switch to combining above 50% of contended enqueues... */
+#define ADAPT_LOW    128 /* ...and back to the mutex below 12.5%, so as not to flip-flop */
+
+/* Feed the adaptive engine with an enqueue which found contention, or not, and switch engines
+ * on crossing a threshold. Called with the lock held.
+ */
+static void
+adapt_sample(cpool* pool, int contended)
+{
+    if (pool->engine != CPOOL_ENGINE_ADAPTIVE) return;
+    pool->contention_rate += ((contended ? 1024 : 0) - pool->contention_rate) / ADAPT_WEIGHT;
+    int combining = atomic_load_explicit(&pool->fc_active, memory_order_relaxed);
+    if (combining ? pool->contention_rate < ADAPT_LOW : pool->contention_rate > ADAPT_HIGH) {
+        /* Requests already published are still applied by lock holders, whichever engine is active. */
+        atomic_store_explicit(&pool->fc_active, !combining, memory_order_relaxed);
+        pool->stats.nb_engine_switches += 1;
+    }
+}
+
+/* Park `worker` on the idle list. Called with the lock held. */
+static void
+idle_push(cpool* pool, cpool_worker* worker)
+{
+    worker->parked    = 1;
+    worker->idle_next = pool->idle_head;
+    pool->idle_head   = worker;
+}
+
+/* Take the most recently parked worker off the idle list, to be woken by signaling its `cond`
+ * (preferably after unlocking). NULL if no worker is parked. Called with the lock held.
+ */
+static cpool_worker*
+idle_pop(cpool* pool)
+{
+    cpool_worker* worker = pool->idle_head;
+    if (!worker) return NULL;
+    pool->idle_head = worker->idle_next;
+    worker->parked  = 0;
+    return worker;
+}
+
+/* Take `worker` off the idle list, wherever it is. Called with the lock held. */
+static void
+idle_remove(cpool* pool, cpool_worker* worker)
+{
+    cpool_worker* prev = NULL;
+    for (cpool_worker* it = pool->idle_head; it != worker; it = it->idle_next) prev = it;
+    if (prev) prev->idle_next = worker->idle_next;
+    else      pool->idle_head = worker->idle_next;
+    worker->parked = 0;
+}
+
+/* Same as idle_pop(), preferring the most recently parked worker of cache domain `domain`, if any. */
+static cpool_worker*
+idle_pop_domain(cpool* pool, size_t domain)
+{
+    if (pool->nb_domains) {
+        for (cpool_worker* it = pool->idle_head; it; it = it->idle_next) {
+            if (it->domain != domain) continue;
+            idle_remove(pool, it);
+            return it;
+        }
+    }
+    return idle_pop(pool);
+}
+
+/* Take up to `nb_jobs` parked workers off the idle list into `woken`, of FC_SLOTS entries, for jobs
+ * enqueued by fc_combine(). Called with the lock held.
+ * Returns the number of workers, to be passed to idle_wake() after unlocking.
+ */
+static size_t
+idle_take(cpool* pool, cpool_worker** woken, size_t nb_jobs)
+{
+    size_t nb_woken = 0;
+    if (nb_jobs > FC_SLOTS) nb_jobs = FC_SLOTS; /* workers woken for the first jobs take the others */
+    while (nb_woken < nb_jobs && (woken[nb_woken] = idle_pop(pool))) ++nb_woken;
+    return nb_woken;
+}
+
+static void
+idle_wake(cpool_worker** woken, size_t nb_woken)
+{
+    for (size_t i = 0; i < nb_woken; ++i) park_wake(woken[i]);
+}
+
+/* Wake all parked workers, e.g. for the pool stopping. Called with the lock held.
+ * Workers woken by `park_all` take themselves off the idle list.
+ */
+static void
+park_wake_all(cpool* pool)
+{
+#ifdef CPOOL_HAVE_FUTEX
+    if (pool->park_waitv) {
+        atomic_fetch_add_explicit(&pool->park_all, 1, memory_order_relaxed);
+        syscall(SYS_futex, &pool->park_all, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+        return;
+    }
+#endif
+    for (cpool_worker* worker; (worker = idle_pop(pool));) park_wake(worker);
+}
+
+/* Move nodes pushed by cpool_enqueue_node() to the FIFO, in push order. Called with the lock held.
+ * Nodes count as enqueued from here on, in the current submission epoch.
+ * Returns whether any node was taken.
+ */
+static int
+nodes_take(cpool* pool)
+{
+    if (!atomic_load(&pool->nodes_in)) return 0;
+    cpool_node* node = atomic_exchange(&pool->nodes_in, NULL);
+    cpool_node* reversed = NULL;
+    cpool_node* tail = node; /* pushed last, run last */
+    size_t nb_nodes = 0;
+    uint64_t now = 0;
+    while (node) {
+        cpool_node* next = node->next;
+        node->next  = reversed;
+        node->epoch = pool->epoch & 1;
+        if (!node->enqueue_ns) { /* enqueued inline, see cpool.h */
+            if (!now) now = now_ns();
+            node->enqueue_ns = now;
+        }
+        reversed = node;
+        node = next;
+        ++nb_nodes;
+    }
+    if (pool->nodes_tail) pool->nodes_tail->next = reversed;
+    else                  pool->nodes_head = reversed;
+    pool->nodes_tail = tail;
+    pool->epoch_pending[pool->epoch & 1] += nb_nodes;
+    pool->stats.nb_enqueued += nb_nodes;
+    pool->fence_jobs += nb_nodes;
+    return 1;
+}
+
+/* Push `job` onto the shard of the current CPU, with the per-CPU engine. The shard lock is only tried:
+ * it is mostly taken by threads running on the same CPU, and contention means one was preempted in it.
+ * This is not an rseq critical section: the push costs an atomic test-and-set and release, besides
+ * sched_getcpu() and the clock read, see the README for measurements. Its point is locality instead:
+ * producers only write to the cache lines of their shard. The one pool-wide line they still touch is read
+ * only, `nb_parked` in enqueue_work(), which is written by workers parking and unparking.
+ * Returns 1 if the shard is full or busy, or the pool is stopped, for the caller to fall back to the mutex.
+ */
+static int
+percpu_push(cpool* pool, cpool_work* job)
+{
+#ifdef __linux__
+    int cpu = sched_getcpu(); /* served from the rseq area by recent glibc, without a system call */
+#else
+    int cpu = -1;
+#endif
+    size_t index = (cpu < 0 ? job->submitter : (unsigned)cpu) % pool->nb_shards;
+    cpool_shard_jobs* shard = &pool->shards[index].s;
+    if (atomic_flag_test_and_set_explicit(&shard->lock, memory_order_acquire)) return 1;
+    /* A final drain of a stopping pool takes every shard lock, after which pushes see the stop. */
+    int rejected = shard->count == PERCPU_SLOTS || pool_stopped(pool);
+    if (!rejected) {
+        job->enqueue_ns = now_ns();
+        shard->jobs[(shard->first + shard->count) % PERCPU_SLOTS] = *job;
+        if (shard->count++ == 0) atomic_store_explicit(&shard->nonempty, 1, memory_order_relaxed);
+    }
+    atomic_flag_clear_explicit(&shard->lock, memory_order_release);
+    return rejected;
+}
+
+/* Whether any per-CPU shard holds jobs. Shards are scanned rather than tracked in a pool-wide mask,
+ * so that producers only write to the cache line of their own shard.
+ */
+static int
+percpu_pending(const cpool* pool)
+{
+    for (size_t i = 0; i < pool->nb_shards; ++i) {
+        if (atomic_load(&pool->shards[i].s.nonempty)) return 1;
+    }
+    return 0;
+}
+
+/* Move the jobs of the per-CPU shards to the queue, in the current submission epoch. Called with the lock held.
+ * With `all`, every shard is locked, including ones not yet seen to hold jobs.
+ * Shards are only moved while the queue holds at most `jobs_limit` jobs, so that they fit in its capacity.
+ * Returns the number of jobs moved, for which workers have to be woken.
+ */
+static size_t
+percpu_drain(cpool* pool, int all)
+{
+    if (!pool->nb_shards || pool_queued(pool) > pool->jobs_limit) return 0;
+    size_t nb_moved = 0;
+    for (size_t i = 0; i < pool->nb_shards; ++i) {
+        cpool_shard_jobs* shard = &pool->shards[i].s;
+        if (!all && !atomic_load(&shard->nonempty)) continue;
+        while (atomic_flag_test_and_set_explicit(&shard->lock, memory_order_acquire)) cpu_relax();
+        cpool_work batch[PERCPU_SLOTS];
+        size_t nb_jobs = shard->count;
+        for (size_t j = 0; j < nb_jobs; ++j) {
+            batch[j] = shard->jobs[(shard->first + j) % PERCPU_SLOTS];
+            batch[j].epoch = pool->epoch & 1;
+        }
+        shard->first = 0;
+        shard->count = 0;
+        if (nb_jobs) atomic_store_explicit(&shard->nonempty, 0, memory_order_relaxed);
+        atomic_flag_clear_explicit(&shard->lock, memory_order_release);
+        pool_push_batch(pool, batch, nb_jobs);
+        nb_moved += nb_jobs;
+    }
+    pool->epoch_pending[pool->epoch & 1] += nb_moved;
+    pool->stats.nb_enqueued += nb_moved;
+    pool->fence_jobs += nb_moved;
+    return nb_moved;
+}
+
+/* Whether `worker` has a job to run, or has to exit, rather than park. Called with the lock held. */
+static inline int
+worker_has_work(const cpool* pool, const cpool_worker* worker)
+{
+    return worker->has_mail || pool_queued(pool) > 0 || pool->nodes_head || pool_stopped(pool) || worker->retired;
+}
+
+static int
+thread_func(void* worker_ptr)
+{
+    cpool_worker* worker = worker_ptr;
+    cpool* pool = worker->pool;
+    worker_apply_sched(pool);
+    worker_apply_domain(worker);
+    worker_set_name(worker);
+    {
+        pool_lock(pool, CPOOL_SITE_OTHER);
+#ifdef __linux__
+        worker->tid = (long)syscall(SYS_gettid);
+#endif
+        pool->nb_started += 1;
+        mtx_unlock(&pool->mutex);
+        cnd_broadcast(&pool->cond_idle); /* cpool_create_ex() waits for workers to start */
+    }
+    for (;;) {
+        cpool_func_t job_func;
+        void* job_data;
+        cpool_future* future;
+        uint64_t job_start, job_enqueue;
+        uint32_t job_submitter;
+        unsigned job_epoch;
+        cpool_prefetch job_prefetch_own, job_prefetch_next = {0};
+        cpool_worker* woken[FC_SLOTS];
+        size_t nb_woken = 0;
+        {
+            pool_lock(pool, CPOOL_SITE_DEQUEUE);
+            size_t combined = fc_combine(pool) + percpu_drain(pool, 0);
+            if (!pool->nodes_head) nodes_take(pool);
+            while (!worker_has_work(pool, worker)) {
+                /* Announce parking before checking for nodes and shards once more: a concurrent
+                 * cpool_enqueue_node(), or per-CPU enqueue, either sees `nb_parked` and wakes a worker
+                 * under the lock, or its job is seen here. See fence_light().
+                 */
+                atomic_fetch_add_explicit(&pool->nb_parked, 1, memory_order_relaxed);
+                if (fence_heavy(pool) && worker_has_work(pool, worker)) { /* while the lock was released */
+                    atomic_fetch_sub_explicit(&pool->nb_parked, 1, memory_order_relaxed);
+                    break;
+                }
+                size_t drained = percpu_drain(pool, 0);
+                combined += drained;
+                if (!nodes_take(pool) && !drained) {
+                    if (pool->sched_ops && pool->sched_ops->on_idle) pool->sched_ops->on_idle(pool->sched);
+                    CPOOL_TRACE(park, 2, pool, worker->index);   /* pool, worker index */
+                    idle_push(pool, worker);
+                    do {
+                        park_wait(pool, worker);
+                    } while (worker->parked && !pool_stopped(pool) && !worker->retired);
+                    if (worker->parked) idle_remove(pool, worker);
+                    CPOOL_TRACE(unpark, 2, pool, worker->index); /* pool, worker index */
+                }
+                atomic_fetch_sub_explicit(&pool->nb_parked, 1, memory_order_relaxed);
+            }
+            if (combined > 1) nb_woken = idle_take(pool, woken, combined - 1); /* this worker takes one */
+            /* a handed off job is run before exiting, it is already counted as working */
+            if (worker->retired && !worker->has_mail) {
+                pool->nb_workers -= 1;
+                mtx_unlock(&pool->mutex);
+                idle_wake(woken, nb_woken);
+                return 0;
+            }
+            if (pool_stopped(pool) && !worker->has_mail && pool_queued(pool) == 0 && !pool->nodes_head
+                && !percpu_drain(pool, 1)) {
+                mtx_unlock(&pool->mutex);
+                idle_wake(woken, nb_woken);
+                return 0;
+            }
+            /* get the next job */
+            cpool_work job_front;
+            if (worker->has_mail) {
+                job_front = worker->mailbox;
+                worker->has_mail = 0;
+                pool->nb_working -= 1; /* counted again below */
+            } else if (pool->nodes_head && (pool_queued(pool) == 0 || (pool->nodes_turn ^= 1))) {
+                cpool_node* node = pool->nodes_head;
+                pool->nodes_head = node->next;
+                if (!pool->nodes_head) pool->nodes_tail = NULL;
+                job_front = (cpool_work){
+                    .func       = node->func,
+                    .data       = node,
+                    .enqueue_ns = node->enqueue_ns,
+                    .submitter  = node->submitter,
+                    .epoch      = (uint8_t)node->epoch,
+                };
+            } else {
+                pool_pop(pool, worker->domain, &job_front);
+                if (pool->nb_drain_waiters && pool_queued(pool) == pool->jobs_limit) {
+                    cnd_broadcast(&pool->cond_idle); /* per-CPU shards fit in the queue again */
+                }
+            }
+            job_func = job_front.func;
+            job_data = job_front.data;
+            future   = job_front.future;
+            job_start = now_ns();
+            job_enqueue   = job_front.enqueue_ns;
+            job_submitter = job_front.submitter;
+            job_epoch     = job_front.epoch;
+            job_prefetch_own = job_prefetch_get(&job_front);
+            const cpool_work* next = pool_peek(pool, worker->domain);
+            if (next) job_prefetch_next = job_prefetch_get(next);
+            hist_add(&pool->stats.wait, job_start - job_enqueue);
+            /* pool, worker index, function, queue wait (ns) */
+            CPOOL_TRACE(dequeue, 4, pool, worker->index, job_func, job_start - job_enqueue);
+            pool->nb_working += 1;
+            mtx_unlock(&pool->mutex);
+        }
+
+        job_prefetch(&job_prefetch_own, job_data, 1); /* overlaps with the wakeup of a blocked enqueue */
+        cnd_signal(&pool->cond_enqueue);
+        idle_wake(woken, nb_woken);
+
+        atomic_store_explicit(&worker->job_func, job_func, memory_order_relaxed);
+        atomic_store_explicit(&worker->job_start, job_start, memory_order_release);
+        CPOOL_TRACE(job_start, 4, pool, worker->index, job_func, job_data); /* pool, worker index, function, data */
+        /* The next job is likely started by whichever worker finishes first, warm it up while this one runs */
+        job_prefetch(&job_prefetch_next, NULL, 0);
+        job_func(job_data);
+        uint64_t job_end = now_ns();
+        atomic_store_explicit(&worker->job_start, 0, memory_order_relaxed);
+        /* pool, worker index, function, run time (ns) */
+        CPOOL_TRACE(job_end, 4, pool, worker->index, job_func, job_end - job_start);
+
+        if (future) {
+            CPOOL_TRACE(future_complete, 2, pool, future); /* pool, future */
+            mtx_lock(&future->mutex);
+            future->flag = 1;
+            /* Signal under the lock: once unlocked, the waiter may release the future, or its storage.
+             * Only one thread is allowed to wait on the future...
+             */
+            cnd_signal(&future->cond);
+            mtx_unlock(&future->mutex);
+        }
+
+        {
+            /* before completing the job, so that it is recorded once cpool_wait() returns */
+            cpool_record record = {
+                .wait_ns    = job_start - job_enqueue,
+                .run_ns     = job_end - job_start,
+                .func       = (uintptr_t)job_func,
+                .thread     = job_submitter,
+                .worker     = (unsigned)worker->index,
+            };
+            record_job(pool, &record, job_enqueue);
+        }
+
+        {
+            pool_lock(pool, CPOOL_SITE_COMPLETE);
+            hist_add(&pool->stats.run, job_end - job_start);
+            pool->stats.nb_completed += 1;
+            if (--pool->epoch_pending[job_epoch] == 0 && job_epoch != (pool->epoch & 1)) {
+                pool->epoch_done = pool->epoch - 1; /* previous epoch drained */
+                cnd_broadcast(&pool->cond_idle);
+            }
+            if (--pool->nb_working == 0 && pool_queued(pool) == 0 && !pool->nodes_head && !atomic_load(&pool->nodes_in)
+                && !percpu_pending(pool)) {
+                cnd_broadcast(&pool->cond_idle);
+            }
+            mtx_unlock(&pool->mutex);
+        }
+    }
+}
+
+/* Launch the worker thread in slot `pool->nb_threads`. */
+static int
+worker_launch(cpool* pool)
+{
+    cpool_worker* worker = pool->workers + pool->nb_threads;
+    worker->pool  = pool;
+    worker->index = pool->nb_threads;
+    worker->tid   = 0;
+    atomic_init(&worker->job_start, 0);
+    atomic_init(&worker->job_func, NULL);
+    worker->retired = 0;
+    worker->reported_start = 0;
+    worker->domain   = pool->nb_worker_domains ? pool->worker_domains[worker->index % pool->nb_worker_domains] : 0;
+    worker->parked   = 0;
+    worker->has_mail = 0;
+    if (park_init(worker)) return 1;
+    if (thrd_create(&worker->thread, thread_func, worker) != thrd_success) {
+        park_destroy(worker);
+        return 1;
+    }
+    pool->nb_threads += 1;
+    return 0;
+}
+
+static int
+watchdog_func(void* pool_ptr)
+{
+    cpool* pool = pool_ptr;
+    pool_lock(pool, CPOOL_SITE_OTHER);
+    while (!pool->stop) {
+        struct timespec deadline;
+        timespec_get(&deadline, TIME_UTC);
+        deadline.tv_sec  += pool->watchdog_interval_ns / 1000000000u;
+        deadline.tv_nsec += pool->watchdog_interval_ns % 1000000000u;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec  += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+        cnd_timedwait(&pool->cond_watchdog, &pool->mutex, &deadline);
+        if (pool->stop) break;
+        mtx_unlock(&pool->mutex);
+
+        uint64_t now = now_ns();
+        for (size_t i = 0; i < pool->nb_threads; ++i) {
+            cpool_worker* worker = pool->workers + i;
+            uint64_t start = atomic_load_explicit(&worker->job_start, memory_order_acquire);
+            if (!start || start == worker->reported_start || now - start < pool->watchdog_threshold_ns) continue;
+            worker->reported_start = start;
+            if (pool->watchdog_func) {
+                cpool_func_t func = atomic_load_explicit(&worker->job_func, memory_order_relaxed);
+                pool->watchdog_func(pool->watchdog_arg, worker->index, func, now - start);
+            }
+            if (pool->nb_threads == pool->max_threads) continue;
+            /* retire the stuck worker and launch a replacement, to keep capacity */
+            pool_lock(pool, CPOOL_SITE_OTHER);
+            cpool_worker* parked = NULL;
+            if (!pool->stop && !worker->retired && worker_launch(pool) == 0) {
+                worker->retired = 1;
+                pool->nb_workers += 1;
+                /* in case the retired worker is already waiting for jobs */
+                if (worker->parked) idle_remove(pool, parked = worker);
+            }
+            mtx_unlock(&pool->mutex);
+            if (parked) park_wake(parked);
+        }
+
+        pool_lock(pool, CPOOL_SITE_OTHER);
+    }
+    mtx_unlock(&pool->mutex);
+    return 0;
+}
+
+void
+cpool_attr_init(cpool_attr* attr, size_t nb_workers, size_t max_jobs)
+{
+    memset(attr, 0, sizeof(*attr));
+    attr->nb_workers = nb_workers;
+    attr->max_jobs   = max_jobs;
+}
+
+cpool*
+cpool_create(size_t nb_workers, size_t max_jobs)
+{
+    cpool_attr attr;
+    cpool_attr_init(&attr, nb_workers, max_jobs);
+    return cpool_create_ex(&attr);
+}
+
+/* Maximum number of worker threads of a pool, including replacements of stuck workers. */
+static size_t
+attr_max_threads(const cpool_attr* attr)
+{
+    return attr->nb_workers + (attr->watchdog_threshold_ns ? attr->watchdog_max_replacements : 0);
+}
+
+/* Number of shards of the per-CPU engine, 0 with other engines, or where it is not supported. */
+static size_t
+attr_nb_shards(const cpool_attr* attr)
+{
+#ifdef __linux__
+    if (attr->engine != CPOOL_ENGINE_PERCPU) return 0;
+    long nb_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    return nb_cpus < 1 ? 1 : nb_cpus > PERCPU_SHARDS ? PERCPU_SHARDS : (size_t)nb_cpus;
+#else
+    (void)attr;
+    return 0;
+#endif
+}
+
+/* Number of cache domains the queue is partitioned into, 0 if it is not: without the `cache_domains` attribute,
+ * with a custom scheduler, a single or unknown domain, or fewer workers than domains, leaving some without.
+ */
+static size_t
+attr_nb_domains(const cpool_attr* attr)
+{
+    if (!attr->cache_domains || attr->scheduler) return 0;
+    call_once(&topology_once, topology_read);
+    return attr->nb_workers >= topology.nb_domains ? topology.nb_domains : 0;
+}
+
+/* Capacity of the job queue: `max_jobs`, plus room for the content of every per-CPU shard,
+ * rounded up to split evenly between cache domains.
+ */
+static size_t
+attr_queue_capacity(const cpool_attr* attr)
+{
+    size_t capacity = attr->max_jobs + attr_nb_shards(attr) * PERCPU_SLOTS;
+    size_t nb_domains = attr_nb_domains(attr);
+    return nb_domains ? (capacity + nb_domains - 1) / nb_domains * nb_domains : capacity;
+}
+
+/* Size of the storage placed for pool_start(): the per-CPU shards, then the job queue, if not in a scheduler.
+ * 0 if it overflows.
+ */
+static size_t
+attr_storage_size(const cpool_attr* attr)
+{
+    if (attr->max_jobs > SIZE_MAX / 2 / sizeof(cpool_work)) return 0;
+    return attr_nb_shards(attr) * sizeof(cpool_shard) + (attr->scheduler ? 0 : attr_queue_capacity(attr) * sizeof(cpool_work));
+}
+
+/* Initialize and start a pool, of which the `workers` array, `name` and `storage`, of attr_storage_size()
+ * bytes, are already placed. Returns 0 on success, 1 on failure, leaving the placed memory to the caller.
+ */
+static int
+pool_start(cpool* pool, const cpool_attr* attr, void* storage)
+{
+    size_t nb_workers = attr->nb_workers;
+    size_t capacity   = attr_queue_capacity(attr);
+    pool->nb_workers  = nb_workers;
+    pool->nb_threads  = 0;
+    pool->nb_started  = 0;
+    pool->nb_working  = 0;
+    pool->idle_head   = NULL;
+#ifdef CPOOL_HAVE_FUTEX
+    atomic_init(&pool->park_all, 0);
+    pool->park_waitv  = futex_waitv_supported();
+#endif
+    pool->stop        = 0;
+    atomic_init(&pool->nodes_in, NULL);
+    pool->nodes_head  = NULL;
+    pool->nodes_tail  = NULL;
+    atomic_init(&pool->nb_parked, 0);
+    atomic_init(&pool->nodes_used, 0);
+#ifdef CPOOL_HAVE_MEMBARRIER
+    pool->asym_supported = membarrier_supported();
+#else
+    pool->asym_supported = 0;
+#endif
+    atomic_init(&pool->asym_fence, pool->asym_supported);
+    pool->fence_jobs     = 0;
+    pool->fence_jobs_avg = FENCE_ASYM_ABOVE;
+    pool->nodes_turn  = 0;
+    pool->engine      = attr->engine;
+    atomic_init(&pool->fc_active, attr->engine == CPOOL_ENGINE_COMBINING);
+    pool->contention_rate = 0;
+    atomic_init(&pool->fc_pending, 0);
+    for (size_t i = 0; i < FC_SLOTS; ++i) atomic_init(&pool->fc_slots[i].req.state, FC_FREE);
+    pool->epoch       = 1;
+    pool->epoch_done  = 0;
+    pool->epoch_pending[0] = pool->epoch_pending[1] = 0;
+    memset(&pool->stats, 0, sizeof(pool->stats));
+#ifdef CPOOL_PROFILE_CONTENTION
+    memset(&pool->contention, 0, sizeof(pool->contention));
+#endif
+    pool->sched_policy          = attr->sched_policy;
+    pool->sched_priority        = attr->sched_priority;
+    pool->sched_nice            = attr->sched_nice;
+    atomic_init(&pool->recorder, NULL);
+    pool->has_watchdog          = 0;
+    pool->watchdog_threshold_ns = attr->watchdog_threshold_ns;
+    pool->watchdog_interval_ns  = attr->watchdog_interval_ns;
+    pool->watchdog_func         = attr->watchdog_func;
+    pool->watchdog_arg          = attr->watchdog_arg;
+    pool->max_threads           = attr_max_threads(attr);
+    if (pool->watchdog_threshold_ns) {
+        if (!pool->watchdog_interval_ns) pool->watchdog_interval_ns = pool->watchdog_threshold_ns / 4;
+        if (!pool->watchdog_interval_ns) pool->watchdog_interval_ns = 1;
+    }
+
+    pool->nb_shards  = attr_nb_shards(attr);
+    pool->shards     = storage;
+    pool->jobs_limit = attr->max_jobs;
+    pool->nb_drain_waiters = 0;
+    for (size_t i = 0; i < pool->nb_shards; ++i) {
+        atomic_flag_clear(&pool->shards[i].s.lock);
+        atomic_init(&pool->shards[i].s.nonempty, 0);
+        pool->shards[i].s.first = pool->shards[i].s.count = 0;
+    }
+
+    /* with a custom scheduler, jobs are stored by the scheduler, and there is no queue storage */
+    cpool_work* jobs = attr->scheduler ? NULL : pool->nb_shards ? (cpool_work*)(pool->shards + pool->nb_shards) : storage;
+    queue_init(&pool->jobs, attr->queue_policy, jobs, attr->scheduler ? 0 : capacity);
+    pool->nb_domains = attr_nb_domains(attr);
+    for (size_t i = 0; i < pool->nb_domains; ++i) {
+        size_t domain_capacity = capacity / pool->nb_domains;
+        queue_init(pool->domain_jobs + i, attr->queue_policy, jobs + i * domain_capacity, domain_capacity);
+    }
+    domains_assign(pool);
+    pool->sched_ops = attr->scheduler;
+    pool->sched     = NULL;
+    if (pool->sched_ops && !(pool->sched = pool->sched_ops->create(attr->scheduler_arg, capacity))) goto sched_fail;
+    if (mtx_init(&pool->mutex, mtx_plain) != thrd_success)                   goto mutex_fail;
+    if (cnd_init(&pool->cond_enqueue)     != thrd_success)                   goto cond_enqueue_fail;
+    if (cnd_init(&pool->cond_idle)        != thrd_success)                   goto cond_idle_fail;
+    if (cnd_init(&pool->cond_watchdog)    != thrd_success)                   goto cond_watchdog_fail;
+    if (mtx_init(&pool->record_mutex, mtx_plain) != thrd_success)            goto record_mutex_fail;
+
+    /* launch workers */
+    while (pool->nb_threads < nb_workers) {
+        if (worker_launch(pool)) break;
+    }
+    int launched = pool->nb_threads == nb_workers;
+    if (launched && pool->watchdog_threshold_ns) {
+        launched = pool->has_watchdog = thrd_create(&pool->watchdog, watchdog_func, pool) == thrd_success;
+    }
+    if (launched) {
+        /* wait for workers to start up, so that their thread IDs are available */
+        pool_lock(pool, CPOOL_SITE_OTHER);
+        while (pool->nb_started < nb_workers) {
+            pool_wait(pool, &pool->cond_idle, CPOOL_COND_IDLE);
+        }
+        mtx_unlock(&pool->mutex);
+        return 0;
+    }
+    /* clean up threads in case of failure */
+    cpool_stop(pool);
+    for (size_t i = 0; i < pool->nb_threads; ++i) {
+        thrd_join(pool->workers[i].thread, NULL);
+        park_destroy(pool->workers + i);
+    }
+
+    mtx_destroy(&pool->record_mutex);
+record_mutex_fail:
+    cnd_destroy(&pool->cond_watchdog);
+cond_watchdog_fail:
+    cnd_destroy(&pool->cond_idle);
+cond_idle_fail:
+    cnd_destroy(&pool->cond_enqueue);
+cond_enqueue_fail:
+    mtx_destroy(&pool->mutex);
+mutex_fail:
+    if (pool->sched_ops) pool->sched_ops->destroy(pool->sched);
+sched_fail:
+    return 1;
+}
+
+cpool*
+cpool_create_ex(const cpool_attr* attr)
+{
+    cpool* pool = NULL;
+    if (!attr->nb_workers || !attr->max_jobs) goto end;
+
+    pool = aligned_alloc(CACHE_LINE, CACHE_LINE_UP(sizeof(cpool)));
+    if (!pool) goto end;
+    pool->allocated = 1;
+    pool->name      = NULL;
+    if (attr->name) {
+        size_t len = strlen(attr->name) + 1;
+        if (!(pool->name = malloc(len))) goto name_fail;
+        memcpy(pool->name, attr->name, len);
+    }
+    if (!(pool->workers = malloc(sizeof(cpool_worker) * attr_max_threads(attr)))) goto workers_fail;
+    size_t storage_size = attr_storage_size(attr);
+    if (!storage_size) {
+        pool->jobs_region.ptr  = NULL; /* jobs are stored by the scheduler */
+        pool->jobs_region.size = 0;
+        if (!attr->scheduler) goto jobs_fail;
+    } else if (region_alloc(&pool->jobs_region, storage_size, attr->hugepages)) {
+        goto jobs_fail;
+    }
+    if (pool_start(pool, attr, pool->jobs_region.ptr)) goto start_fail;
+    goto end;
+
+start_fail:
+    region_free(&pool->jobs_region);
+jobs_fail:
+    free(pool->workers);
+workers_fail:
+    free(pool->name);
+name_fail:
+    free(pool);
+    pool = NULL;
+end:
+    return pool;
+}
+
+/* Layout of a pool in caller memory: the pool, then the workers, the shards and job queue, and the name.
+ * Returns the total size, or 0 if it overflows.
+ */
+static size_t
+pool_layout(const cpool_attr* attr, size_t* workers_offset, size_t* jobs_offset, size_t* name_offset)
+{
+    size_t max_threads = attr_max_threads(attr);
+    *workers_offset = *jobs_offset = *name_offset = 0;
+    if (max_threads > SIZE_MAX / 2 / sizeof(cpool_worker) || attr->max_jobs > SIZE_MAX / 2 / sizeof(cpool_work)) {
+        return 0;
+    }
+    *workers_offset = CACHE_LINE_UP(sizeof(cpool));
+    *jobs_offset    = CACHE_LINE_UP(*workers_offset + sizeof(cpool_worker) * max_threads);
+    *name_offset    = *jobs_offset + attr_storage_size(attr);
+    return *name_offset + (attr->name ? strlen(attr->name) + 1 : 0);
+}
+
+size_t
+cpool_required_size_ex(const cpool_attr* attr)
+{
+    size_t workers_offset, jobs_offset, name_offset;
+    return pool_layout(attr, &workers_offset, &jobs_offset, &name_offset);
+}
+
+size_t
+cpool_required_size(size_t nb_workers, size_t max_jobs)
+{
+    cpool_attr attr;
+    cpool_attr_init(&attr, nb_workers, max_jobs);
+    return cpool_required_size_ex(&attr);
+}
+
+cpool*
+cpool_init_ex(void* mem, size_t mem_size, const cpool_attr* attr)
+{
+    size_t workers_offset, jobs_offset, name_offset;
+    size_t size = pool_layout(attr, &workers_offset, &jobs_offset, &name_offset);
+    if (!attr->nb_workers || !attr->max_jobs || !size || mem_size < size) return NULL;
+    if ((uintptr_t)mem % CACHE_LINE) return NULL;
+
+    char* base = mem;
+    cpool* pool = mem;
+    pool->allocated = 0;
+    pool->workers   = (cpool_worker*)(base + workers_offset);
+    pool->jobs_region.ptr  = NULL;
+    pool->jobs_region.size = 0;
+    pool->name = NULL;
+    if (attr->name) {
+        pool->name = base + name_offset;
+        memcpy(pool->name, attr->name, size - name_offset);
+    }
+    return pool_start(pool, attr, base + jobs_offset) ? NULL : pool;
+}
+
+cpool*
+cpool_init(void* mem, size_t mem_size, size_t nb_workers, size_t max_jobs)
+{
+    cpool_attr attr;
+    cpool_attr_init(&attr, nb_workers, max_jobs);
+    return cpool_init_ex(mem, mem_size, &attr);
+}
+
+void
+cpool_destroy(cpool* pool)
+{
+    cpool_stop(pool);
+    /* join the watchdog first, it may launch workers */
+    if (pool->has_watchdog) thrd_join(pool->watchdog, NULL);
+    for (size_t i = 0; i < pool->nb_threads; ++i) {
+        thrd_join(pool->workers[i].thread, NULL);
+        park_destroy(pool->workers + i);
+    }
+    /* run nodes enqueued concurrently with the stop, after the workers exited */
+    nodes_take(pool);
+    for (cpool_node* node = pool->nodes_head, *next; node; node = next) {
+        next = node->next;
+        node->func(node);
+    }
+    cpool_record_stop(pool);
+    mtx_destroy(&pool->record_mutex);
+    cnd_destroy(&pool->cond_watchdog);
+    cnd_destroy(&pool->cond_idle);
+    cnd_destroy(&pool->cond_enqueue);
+    mtx_destroy(&pool->mutex);
+    if (pool->sched_ops) pool->sched_ops->destroy(pool->sched);
+    region_free(&pool->jobs_region);
+    if (pool->allocated) {
+        free(pool->workers);
+        free(pool->name);
+        free(pool);
+    }
+}
+
+/* Claim a free publication slot of the combining engine, preferably the one of this thread. NULL if none. */
+static cpool_fc_slot*
+fc_claim(cpool* pool, uint32_t submitter)
+{
+    for (size_t i = 0; i < FC_SLOTS; ++i) {
+        cpool_fc_slot* slot = pool->fc_slots + (submitter + i) % FC_SLOTS;
+        int expected = FC_FREE;
+        if (atomic_load_explicit(&slot->req.state, memory_order_relaxed) == FC_FREE
+            && atomic_compare_exchange_strong_explicit(&slot->req.state, &expected, FC_CLAIMED,
+                                                       memory_order_acquire, memory_order_relaxed)) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/* Enqueue through the combining engine: publish the job, then spin until a lock holder has applied it,
+ * or take the lock and combine.
+ */
+static int
+enqueue_combining(cpool* pool, cpool_fc_slot* slot, const cpool_work* job)
+{
+    slot->req.job = *job;
+    atomic_fetch_add_explicit(&pool->fc_pending, 1, memory_order_relaxed);
+    atomic_store_explicit(&slot->req.state, FC_PENDING, memory_order_release);
+
+    int state, blocked = 0;
+    unsigned spins = 0;
+    while ((state = atomic_load_explicit(&slot->req.state, memory_order_acquire)) == FC_PENDING) {
+        if (pool_trylock(pool, CPOOL_SITE_ENQUEUE)) {
+            if (++spins < FC_SPINS) {
+                cpu_relax();
+                continue;
+            }
+            pool_lock(pool, CPOOL_SITE_ENQUEUE);
+        }
+        spins = 0;
+        size_t nb_enqueued = fc_combine(pool);
+        cpool_worker* woken[FC_SLOTS];
+        adapt_sample(pool, nb_enqueued > 1); /* other requests were waiting */
+        if (atomic_load_explicit(&slot->req.state, memory_order_relaxed) == FC_PENDING) {
+            /* the queue is full */
+            CPOOL_TRACE(enqueue_blocked, 2, pool, pool_queued(pool)); /* pool, queue depth */
+            uint64_t block_start = now_ns();
+            pool_wait(pool, &pool->cond_enqueue, CPOOL_COND_ENQUEUE);
+            pool->stats.nb_enqueue_blocked += !blocked;
+            pool->stats.enqueue_block_ns += now_ns() - block_start;
+            blocked = 1;
+            nb_enqueued += fc_combine(pool);
+        }
+        size_t nb_woken = idle_take(pool, woken, nb_enqueued);
+        mtx_unlock(&pool->mutex);
+        idle_wake(woken, nb_woken);
+    }
+    atomic_store_explicit(&slot->req.state, FC_FREE, memory_order_relaxed);
+    return state == FC_REJECTED;
+}
+
+/* Enqueue `job`, of which the caller sets the function, data and ordering parameters.
+ * If `future` is not NULL, a future is created and output, otherwise `job->future` is used, if set.
+ */
+static int
+enqueue_work(cpool* pool, cpool_work* job, cpool_future** future)
+{
+    job->submitter = current_submitter();
+    job->domain    = pool->nb_domains ? (unsigned char)current_domain() : 0;
+    if (future) job->future = *future = cpool_future_create();
+    if (pool->nb_shards && !percpu_push(pool, job)) {
+        CPOOL_TRACE(enqueue, 4, pool, job->func, job->data, 0); /* pool, function, data, queue depth (unknown) */
+        fence_light(pool);
+        if (atomic_load_explicit(&pool->nb_parked, memory_order_relaxed)) cpool_wake_parked_(pool);
+        return 0;
+    }
+    cpool_fc_slot* slot;
+    if (atomic_load_explicit(&pool->fc_active, memory_order_relaxed) && (slot = fc_claim(pool, job->submitter))) {
+        job->enqueue_ns = now_ns();
+        if (!enqueue_combining(pool, slot, job)) return 0;
+        if (job->future) cpool_future_destroy(job->future);
+        if (future) *future = NULL;
+        return 1;
+    }
+    cpool_worker* worker;
+    {
+        if (pool->engine == CPOOL_ENGINE_ADAPTIVE) adapt_sample(pool, pool_lock_probe(pool, CPOOL_SITE_ENQUEUE));
+        else pool_lock(pool, CPOOL_SITE_ENQUEUE);
+        if (pool_queued(pool) >= pool->jobs_limit && !pool_stopped(pool)) {
+            CPOOL_TRACE(enqueue_blocked, 2, pool, pool_queued(pool)); /* pool, queue depth */
+            uint64_t block_start = now_ns();
+            do {
+                pool_wait(pool, &pool->cond_enqueue, CPOOL_COND_ENQUEUE);
+            } while (pool_queued(pool) >= pool->jobs_limit && !pool_stopped(pool));
+            pool->stats.nb_enqueue_blocked += 1;
+            pool->stats.enqueue_block_ns += now_ns() - block_start;
+        }
+        if (pool_stopped(pool)) {
+            mtx_unlock(&pool->mutex);
+            if (job->future) cpool_future_destroy(job->future);
+            if (future) *future = NULL;
+            return 1;
+        }
+        job->enqueue_ns = now_ns();
+        job->epoch      = pool->epoch & 1;
+        pool->epoch_pending[job->epoch] += 1;
+        pool->stats.nb_enqueued += 1;
+        worker = idle_pop_domain(pool, job->domain);
+        if (worker && !pool->sched_ops && pool_queued(pool) == 0 && !pool->nodes_head) {
+            /* Hand off to the parked worker: nothing is queued ahead of the job, so it would be this worker's
+             * next job anyway. It is counted as working from here, as if it had been dequeued.
+             */
+            worker->mailbox  = *job;
+            worker->has_mail = 1;
+            pool->nb_working += 1;
+            pool->stats.nb_handoffs += 1;
+        } else {
+            pool_push(pool, job);
+        }
+        CPOOL_TRACE(enqueue, 4, pool, job->func, job->data, pool_queued(pool)); /* pool, function, data, queue depth */
+        mtx_unlock(&pool->mutex);
+    }
+    if (worker) park_wake(worker);
+    return 0;
+}
+
+int
+cpool_enqueue(cpool* pool, cpool_func_t func, void* data, cpool_future** future)
+{
+    return cpool_enqueue_key(pool, func, data, 0, future);
+}
+
+int
+cpool_enqueue_key(cpool* pool, cpool_func_t func, void* data, unsigned long long key, cpool_future** future)
+{
+    cpool_work job = { .func = func, .data = data, .key = key };
+    return enqueue_work(pool, &job, future);
+}
+
+int
+cpool_enqueue_prefetch(cpool* pool, cpool_func_t func, void* data, const cpool_prefetch* prefetch,
+                       cpool_future** future)
+{
+    /* Packed into the job, which keeps jobs without prefetching to a cache line. */
+    cpool_work job = { .func = func, .data = data };
+    if (prefetch && prefetch->func) {
+        job.prefetch.func = prefetch->func;
+        job.prefetch_len  = PREFETCH_FUNC;
+    } else if (prefetch && prefetch->addr && prefetch->len) {
+        job.prefetch.addr = prefetch->addr;
+        job.prefetch_len  = (unsigned short)(prefetch->len < PREFETCH_MAX ? prefetch->len : PREFETCH_MAX);
+    }
+    return enqueue_work(pool, &job, future);
+}
+
+void
+cpool_wake_parked_(cpool* pool)
+{
+    /* the worker is either before its last check for nodes, or waiting */
+    pool_lock(pool, CPOOL_SITE_ENQUEUE);
+    cpool_worker* worker = idle_pop(pool);
+    mtx_unlock(&pool->mutex);
+    if (worker) park_wake(worker);
+}
+
+void
+cpool_use_nodes_(cpool* pool)
+{
+    pool_lock(pool, CPOOL_SITE_ENQUEUE);
+    atomic_store_explicit(&pool->nodes_used, 1, memory_order_release);
+    mtx_unlock(&pool->mutex);
+}
+
+#ifdef CPOOL_INLINE_FAST_PATHS
+/* external definition of the inline fast path of cpool.h */
+extern inline int cpool_enqueue_node(cpool* pool, cpool_node* node);
+#else
+int
+cpool_enqueue_node(cpool* pool, cpool_node* node)
+{
+    if (pool_stopped(pool)) return 1;
+    if (!atomic_load_explicit(&pool->nodes_used, memory_order_acquire)) cpool_use_nodes_(pool);
+    node->enqueue_ns = now_ns();
+    node->submitter  = current_submitter();
+    cpool_node* head = atomic_load_explicit(&pool->nodes_in, memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->nodes_in, &head, node,
+                                                    memory_order_release, memory_order_relaxed));
+    CPOOL_TRACE(enqueue, 4, pool, node->func, node, 0); /* pool, function, data, queue depth (unknown) */
+    fence_light(pool);
+    if (atomic_load_explicit(&pool->nb_parked, memory_order_relaxed)) cpool_wake_parked_(pool);
+    return 0;
+}
+#endif
+
+int
+cpool_enqueue_future(cpool* pool, cpool_func_t func, void* data, cpool_future* future)
+{
+    cpool_work job = { .func = func, .data = data, .future = future };
+    return enqueue_work(pool, &job, NULL);
+}
+
+void
+cpool_stop(cpool* pool)
+{
+    {
+        pool_lock(pool, CPOOL_SITE_OTHER);
+        pool->stop = 1;
+        park_wake_all(pool); /* rare enough to wake under the lock */
+        mtx_unlock(&pool->mutex);
+    }
+    cnd_broadcast(&pool->cond_enqueue);
+    cnd_signal(&pool->cond_watchdog);
+}
+
+void
+cpool_wait(cpool* pool)
+{
+    pool_lock(pool, CPOOL_SITE_WAIT);
+    while (pool->nb_working > 0 || pool_queued(pool) > 0 || pool->nodes_head || atomic_load(&pool->nodes_in)
+           || percpu_pending(pool)) {
+        pool_wait(pool, &pool->cond_idle, CPOOL_COND_IDLE);
+    }
+    mtx_unlock(&pool->mutex);
+}
+
+void
+cpool_wait_submitted(cpool* pool)
+{
+    pool_lock(pool, CPOOL_SITE_WAIT);
+    nodes_take(pool); /* count nodes and per-CPU jobs pushed before the call in the current epoch */
+    pool->nb_drain_waiters += 1;
+    while (pool_queued(pool) > pool->jobs_limit) pool_wait(pool, &pool->cond_idle, CPOOL_COND_IDLE);
+    pool->nb_drain_waiters -= 1;
+    size_t nb_drained = percpu_drain(pool, 1);
+    if (nb_drained) {
+        cpool_worker* woken[FC_SLOTS];
+        idle_wake(woken, idle_take(pool, woken, nb_drained)); /* under the lock, this is not a hot path */
+    }
+    uint64_t target = pool->epoch;
+    while (pool->epoch_done < target) {
+        /* Start a new epoch for later jobs, once the previous one has drained and its parity is free. */
+        if (pool->epoch == target && pool->epoch_pending[(target - 1) & 1] == 0) {
+            pool->epoch = target + 1;
+            if (pool->epoch_pending[target & 1] == 0) pool->epoch_done = target;
+            continue;
+        }
+        pool_wait(pool, &pool->cond_idle, CPOOL_COND_IDLE);
+    }
+    mtx_unlock(&pool->mutex);
+}
+
+void
+cpool_wait_future(cpool_future* future)
+{
+    {
+        mtx_lock(&future->mutex);
+        while (!future->flag) {
+            cnd_wait(&future->cond, &future->mutex);
+        }
+        mtx_unlock(&future->mutex);
+    }
+    /* Following our assumptions, this should be the last reference to the future, so destroy it. */
+    cpool_future_destroy(future);
+}
+
+#ifdef CPOOL_INLINE_FAST_PATHS
+/* external definition of the inline fast path of cpool.h */
+extern inline int cpool_future_done(const cpool_future* future);
+#else
+int
+cpool_future_done(const cpool_future* future)
+{
+    return atomic_load_explicit(&future->flag, memory_order_acquire);
+}
+#endif
+
+#define WARMUP_STACK (64 * 1024) /* bytes of stack faulted in by warm-up jobs */
+#define PAGE_STRIDE 4096         /* touching every 4 KiB faults in pages of any size */
+
+typedef struct {
+    mtx_t mutex;
+    cnd_t cond;
+    size_t arrived, finished, expected;
+} warmup_barrier;
+
+static void
+warmup_job(void* arg)
+{
+    warmup_barrier* barrier = arg;
+    volatile char stack[WARMUP_STACK];
+    for (size_t i = 0; i < sizeof(stack); i += PAGE_STRIDE) stack[i] = 0;
+    void* volatile block = malloc(64); /* creates the thread's malloc arena, if any */
+    free(block);
+
+    /* hold this worker until every worker has taken a warm-up job */
+    mtx_lock(&barrier->mutex);
+    if (++barrier->arrived >= barrier->expected) cnd_broadcast(&barrier->cond);
+    while (barrier->arrived < barrier->expected) cnd_wait(&barrier->cond, &barrier->mutex);
+    if (++barrier->finished == barrier->expected) cnd_broadcast(&barrier->cond);
+    mtx_unlock(&barrier->mutex);
+}
+
+/* Fault in all pages of the job queue. Items are only written to under the lock, so rewriting them is safe. */
+static void
+queue_prefault(cpool* pool)
+{
+    if (pool->sched_ops) return; /* jobs are stored by the scheduler */
+    char* begin = (char*)pool->jobs.items;
+    size_t size = pool->jobs.capacity * sizeof(cpool_work);
+#if defined(__linux__) && defined(MADV_POPULATE_WRITE)
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)begin & ~(page - 1);
+    if (madvise((void*)start, (uintptr_t)begin + size - start, MADV_POPULATE_WRITE) == 0) return;
+#endif
+    volatile char* bytes = begin;
+    pool_lock(pool, CPOOL_SITE_OTHER);
+    for (size_t i = 0; i < size; i += PAGE_STRIDE) bytes[i] = bytes[i];
+    bytes[size - 1] = bytes[size - 1];
+    mtx_unlock(&pool->mutex);
+}
+
+int
+cpool_warmup(cpool* pool)
+{
+    queue_prefault(pool);
+
+    pool_lock(pool, CPOOL_SITE_OTHER);
+    size_t nb_workers = pool->nb_workers;
+    mtx_unlock(&pool->mutex);
+
+    warmup_barrier barrier = { .arrived = 0, .finished = 0, .expected = nb_workers };
+    if (mtx_init(&barrier.mutex, mtx_plain) != thrd_success) return 1;
+    if (cnd_init(&barrier.cond) != thrd_success) {
+        mtx_destroy(&barrier.mutex);
+        return 1;
+    }
+    size_t nb_enqueued = 0;
+    while (nb_enqueued < nb_workers && !cpool_enqueue(pool, warmup_job, &barrier, NULL)) ++nb_enqueued;
+
+    mtx_lock(&barrier.mutex);
+    if (nb_enqueued < nb_workers) { /* stopped: release the jobs already enqueued */
+        barrier.expected = nb_enqueued;
+        cnd_broadcast(&barrier.cond);
+    }
+    while (barrier.finished < barrier.expected) cnd_wait(&barrier.cond, &barrier.mutex);
+    mtx_unlock(&barrier.mutex);
+    cnd_destroy(&barrier.cond);
+    mtx_destroy(&barrier.mutex);
+
+    if (nb_enqueued < nb_workers) return 1;
+    cpool_wait(pool);
+    return 0;
+}
+
+/* Output sink for text rendering: either a stream, or a buffer with snprintf semantics. */
+typedef struct {
+    FILE* file;
+    char* buf;
+    size_t size;
+    size_t len;  /* characters produced so far (possibly beyond `size`) */
+    int error;
+} sink;
+
+static void
+sink_printf(sink* s, const char* fmt, ...)
+{
+    if (s->error) return;
+    va_list args;
+    va_start(args, fmt);
+    int n;
+    if (s->file) {
+        n = vfprintf(s->file, fmt, args);
+    }
+    else {
+        char* dst = s->len < s->size ? s->buf + s->len : NULL;
+        n = vsnprintf(dst, dst ? s->size - s->len : 0, fmt, args);
+    }
+    va_end(args);
+    if (n < 0) s->error = 1;
+    else s->len += (size_t)n;
+}
+
+/* Print a label value, escaped as required by the exposition format. */
+static void
+sink_label_value(sink* s, const char* value)
+{
+    for (; *value; ++value) {
+        switch (*value) {
+        case '\\': sink_printf(s, "\\\\"); break;
+        case '"':  sink_printf(s, "\\\""); break;
+        case '\n': sink_printf(s, "\\n");  break;
+        default:   sink_printf(s, "%c", *value);
+        }
+    }
+}
+
+typedef struct {
+    const char* name;
+    size_t nb_workers, nb_working, nb_idle, job_count, max_jobs;
+    size_t combining;
+    cpool_stats stats;
+#ifdef CPOOL_PROFILE_CONTENTION
+    cpool_contention contention;
+#endif
+} metrics_snapshot;
+
+static void
+metrics_sample(sink* s, const char* name, const char* suffix, const metrics_snapshot* snap)
+{
+    sink_printf(s, "%s%s{pool=\"", name, suffix);
+    sink_label_value(s, snap->name);
+    sink_printf(s, "\"");
+}
+
+static void
+metrics_gauge(sink* s, const metrics_snapshot* snaps, size_t n, const char* name, const char* help,
+              size_t offset)
+{
+    sink_printf(s, "# TYPE %s gauge\n# HELP %s %s\n", name, name, help);
+    for (size_t i = 0; i < n; ++i) {
+        metrics_sample(s, name, "", snaps + i);
+        sink_printf(s, "} %zu\n", *(const size_t*)((const char*)(snaps + i) + offset));
+    }
+}
+
+static void
+metrics_counter(sink* s, const metrics_snapshot* snaps, size_t n, const char* name, const char* help,
+                size_t offset)
+{
+    sink_printf(s, "# TYPE %s counter\n# HELP %s %s\n", name, name, help);
+    for (size_t i = 0; i < n; ++i) {
+        metrics_sample(s, name, "_total", snaps + i);
+        sink_printf(s, "} %llu\n", (unsigned long long)*(const uint64_t*)((const char*)(snaps + i) + offset));
+    }
+}
+
+static void
+metrics_histogram(sink* s, const metrics_snapshot* snaps, size_t n, const char* name, const char* help,
+                  size_t offset)
+{
+    sink_printf(s, "# TYPE %s histogram\n# HELP %s %s\n# UNIT %s seconds\n", name, name, help, name);
+    for (size_t i = 0; i < n; ++i) {
+        const cpool_hist* hist = (const cpool_hist*)((const char*)(snaps + i) + offset);
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b < HIST_BUCKETS; ++b) {
+            cumulative += hist->count[b];
+            metrics_sample(s, name, "_bucket", snaps + i);
+            if (b < HIST_BUCKETS - 1) sink_printf(s, ",le=\"%g\"", hist_bounds[b] / 1e9);
+            else                      sink_printf(s, ",le=\"+Inf\"");
+            sink_printf(s, "} %llu\n", (unsigned long long)cumulative);
+        }
+        metrics_sample(s, name, "_count", snaps + i);
+        sink_printf(s, "} %llu\n", (unsigned long long)cumulative);
+        metrics_sample(s, name, "_sum", snaps + i);
+        sink_printf(s, "} %.9f\n", hist->sum_ns / 1e9);
+    }
+}
+
+#ifdef CPOOL_PROFILE_CONTENTION
+static const char* const site_names[CPOOL_SITE_COUNT] = { "enqueue", "dequeue", "complete", "wait", "other" };
+static const char* const cond_names[CPOOL_COND_COUNT] = { "work", "enqueue", "idle" };
+
+static void
+metrics_contention(sink* s, const metrics_snapshot* snaps, size_t n)
+{
+    sink_printf(s, "# TYPE cpool_mutex_acquisitions counter\n"
+                   "# HELP cpool_mutex_acquisitions Pool mutex acquisitions.\n");
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t site = 0; site < CPOOL_SITE_COUNT; ++site) {
+            metrics_sample(s, "cpool_mutex_acquisitions", "_total", snaps + i);
+            sink_printf(s, ",site=\"%s\"} %llu\n", site_names[site], snaps[i].contention.site[site].acquired);
+        }
+    }
+    sink_printf(s, "# TYPE cpool_mutex_contended counter\n"
+                   "# HELP cpool_mutex_contended Pool mutex acquisitions that failed the initial try-lock.\n");
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t site = 0; site < CPOOL_SITE_COUNT; ++site) {
+            metrics_sample(s, "cpool_mutex_contended", "_total", snaps + i);
+            sink_printf(s, ",site=\"%s\"} %llu\n", site_names[site], snaps[i].contention.site[site].contended);
+        }
+    }
+    sink_printf(s, "# TYPE cpool_mutex_wait_seconds counter\n"
+                   "# HELP cpool_mutex_wait_seconds Time spent blocked acquiring the pool mutex.\n"
+                   "# UNIT cpool_mutex_wait_seconds seconds\n");
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t site = 0; site < CPOOL_SITE_COUNT; ++site) {
+            metrics_sample(s, "cpool_mutex_wait_seconds", "_total", snaps + i);
+            sink_printf(s, ",site=\"%s\"} %.9f\n", site_names[site],
+                        snaps[i].contention.site[site].wait_ns / 1e9);
+        }
+    }
+
+    sink_printf(s, "# TYPE cpool_cond_waits counter\n"
+                   "# HELP cpool_cond_waits Waits on pool condition variables.\n");
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t cond = 0; cond < CPOOL_COND_COUNT; ++cond) {
+            metrics_sample(s, "cpool_cond_waits", "_total", snaps + i);
+            sink_printf(s, ",cond=\"%s\"} %llu\n", cond_names[cond], snaps[i].contention.cond[cond].waits);
+        }
+    }
+    sink_printf(s, "# TYPE cpool_cond_wait_seconds counter\n"
+                   "# HELP cpool_cond_wait_seconds Time spent waiting on pool condition variables.\n"
+                   "# UNIT cpool_cond_wait_seconds seconds\n");
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t cond = 0; cond < CPOOL_COND_COUNT; ++cond) {
+            metrics_sample(s, "cpool_cond_wait_seconds", "_total", snaps + i);
+            sink_printf(s, ",cond=\"%s\"} %.9f\n", cond_names[cond],
+                        snaps[i].contention.cond[cond].wait_ns / 1e9);
+        }
+    }
+}
+#endif
+
+static int
+metrics_render(sink* s, cpool* const* pools, const char* const* names, size_t nb_pools)
+{
+    metrics_snapshot* snaps = calloc(nb_pools ? nb_pools : 1, sizeof(*snaps));
+    if (!snaps) return 1;
+    for (size_t i = 0; i < nb_pools; ++i) {
+        cpool* pool = pools[i];
+        snaps[i].name = names && names[i] ? names[i] : pool->name ? pool->name : "";
+        pool_lock(pool, CPOOL_SITE_OTHER);
+        snaps[i].nb_workers = pool->nb_workers;
+        snaps[i].nb_working = pool->nb_working;
+        snaps[i].job_count  = pool_queued(pool);
+        snaps[i].max_jobs   = pool->jobs_limit;
+        snaps[i].stats      = pool->stats;
+        snaps[i].combining  = (size_t)atomic_load_explicit(&pool->fc_active, memory_order_relaxed);
+#ifdef CPOOL_PROFILE_CONTENTION
+        snaps[i].contention = pool->contention;
+#endif
+        mtx_unlock(&pool->mutex);
+        snaps[i].nb_idle = snaps[i].nb_workers - snaps[i].nb_working;
+    }
+
+    /* Each family is emitted once, with one sample per pool,
+     * so that the output for several pools is still a single valid exposition.
+     */
+    metrics_gauge(s, snaps, nb_pools, "cpool_queue_depth", "Jobs waiting in the queue.",
+                  offsetof(metrics_snapshot, job_count));
+    metrics_gauge(s, snaps, nb_pools, "cpool_queue_capacity", "Capacity of the job queue.",
+                  offsetof(metrics_snapshot, max_jobs));
+    metrics_gauge(s, snaps, nb_pools, "cpool_workers", "Worker threads.",
+                  offsetof(metrics_snapshot, nb_workers));
+    metrics_gauge(s, snaps, nb_pools, "cpool_workers_busy", "Workers running a job.",
+                  offsetof(metrics_snapshot, nb_working));
+    metrics_gauge(s, snaps, nb_pools, "cpool_workers_idle", "Workers not running a job.",
+                  offsetof(metrics_snapshot, nb_idle));
+    metrics_counter(s, snaps, nb_pools, "cpool_jobs_enqueued", "Jobs accepted by enqueue.",
+                    offsetof(metrics_snapshot, stats.nb_enqueued));
+    metrics_counter(s, snaps, nb_pools, "cpool_jobs_completed", "Jobs finished by workers.",
+                    offsetof(metrics_snapshot, stats.nb_completed));
+    metrics_counter(s, snaps, nb_pools, "cpool_enqueue_blocked", "Enqueue calls that waited for a free slot.",
+                    offsetof(metrics_snapshot, stats.nb_enqueue_blocked));
+    metrics_gauge(s, snaps, nb_pools, "cpool_engine_combining", "Whether enqueues use the combining engine.",
+                  offsetof(metrics_snapshot, combining));
+    metrics_counter(s, snaps, nb_pools, "cpool_engine_switches", "Switches of the adaptive engine.",
+                    offsetof(metrics_snapshot, stats.nb_engine_switches));
+    metrics_counter(s, snaps, nb_pools, "cpool_jobs_handed_off", "Jobs handed off to a parked worker.",
+                    offsetof(metrics_snapshot, stats.nb_handoffs));
+    metrics_counter(s, snaps, nb_pools, "cpool_jobs_stolen", "Jobs taken from the queue of another cache domain.",
+                    offsetof(metrics_snapshot, stats.nb_steals));
+    metrics_counter(s, snaps, nb_pools, "cpool_membarriers", "membarrier() calls of parking workers.",
+                    offsetof(metrics_snapshot, stats.nb_membarriers));
+    metrics_counter(s, snaps, nb_pools, "cpool_fence_switches",
+                    "Switches between asymmetric (membarrier) and symmetric fences.",
+                    offsetof(metrics_snapshot, stats.nb_fence_switches));
+
+    sink_printf(s, "# TYPE cpool_enqueue_blocked_seconds counter\n"
+                   "# HELP cpool_enqueue_blocked_seconds Time enqueue spent waiting for a free slot.\n"
+                   "# UNIT cpool_enqueue_blocked_seconds seconds\n");
+    for (size_t i = 0; i < nb_pools; ++i) {
+        metrics_sample(s, "cpool_enqueue_blocked_seconds", "_total", snaps + i);
+        sink_printf(s, "} %.9f\n", snaps[i].stats.enqueue_block_ns / 1e9);
+    }
+
+    metrics_histogram(s, snaps, nb_pools, "cpool_job_wait_seconds", "Time jobs spent queued.",
+                      offsetof(metrics_snapshot, stats.wait));
+    metrics_histogram(s, snaps, nb_pools, "cpool_job_run_seconds", "Time jobs spent running.",
+                      offsetof(metrics_snapshot, stats.run));
+#ifdef CPOOL_PROFILE_CONTENTION
+    metrics_contention(s, snaps, nb_pools);
+#endif
+    sink_printf(s, "# EOF\n");
+
+    free(snaps);
+    return s->error;
+}
+
+int
+cpool_metrics_write(cpool* const* pools, const char* const* names, size_t nb_pools, FILE* out)
+{
+    sink s = { .file = out };
+    return metrics_render(&s, pools, names, nb_pools);
+}
+
+size_t
+cpool_metrics_snprint(char* buf, size_t size, cpool* const* pools, const char* const* names, size_t nb_pools)
+{
+    sink s = { .buf = buf, .size = size };
+    if (metrics_render(&s, pools, names, nb_pools)) return 0;
+    return s.len;
+}
+
+int
+cpool_contention_get(cpool* pool, cpool_contention* out)
+{
+#ifdef CPOOL_PROFILE_CONTENTION
+    pool_lock(pool, CPOOL_SITE_OTHER);
+    *out = pool->contention;
+    mtx_unlock(&pool->mutex);
+    return 0;
+#else
+    (void)pool;
+    memset(out, 0, sizeof(*out));
+    return 1;
+#endif
+}
+
+int
+cpool_contention_print(cpool* pool, FILE* out)
+{
+#ifdef CPOOL_PROFILE_CONTENTION
+    cpool_contention c;
+    cpool_contention_get(pool, &c);
+    int err = fprintf(out, "%-10s %12s %12s %8s %14s\n", "site", "acquired", "contended", "ratio", "wait(s)") < 0;
+    for (size_t site = 0; site < CPOOL_SITE_COUNT; ++site) {
+        double ratio = c.site[site].acquired ? (double)c.site[site].contended / c.site[site].acquired : 0.0;
+        err |= fprintf(out, "%-10s %12llu %12llu %8.4f %14.6f\n", site_names[site],
+                       c.site[site].acquired, c.site[site].contended, ratio, c.site[site].wait_ns / 1e9) < 0;
+    }
+    err |= fprintf(out, "%-10s %12s %26s\n", "cond", "waits", "wait(s)") < 0;
+    for (size_t cond = 0; cond < CPOOL_COND_COUNT; ++cond) {
+        err |= fprintf(out, "%-10s %12llu %26.6f\n", cond_names[cond],
+                       c.cond[cond].waits, c.cond[cond].wait_ns / 1e9) < 0;
+    }
+    return err;
+#else
+    (void)pool;
+    (void)out;
+    return 1;
+#endif
+}
+
+size_t
+cpool_worker_tids(cpool* pool, long* out, size_t max)
+{
+    size_t n = 0;
+#ifdef __linux__
+    pool_lock(pool, CPOOL_SITE_OTHER);
+    for (size_t i = 0; i < pool->nb_threads; ++i) {
+        const cpool_worker* worker = pool->workers + i;
+        if (worker->retired) continue;
+        if (n < max) out[n] = worker->tid;
+        n += 1;
+    }
+    mtx_unlock(&pool->mutex);
+#else
+    (void)pool;
+    (void)out;
+    (void)max;
+#endif
+    return n;
+}
+
+int
+cpool_record_start(cpool* pool, FILE* out)
+{
+    cpool_recorder* rec = NULL;
+    mtx_lock(&pool->record_mutex);
+    /* checked first, not to write a header into the stream of an active recording */
+    if (atomic_load_explicit(&pool->recorder, memory_order_relaxed)) goto fail;
+    if (!(rec = malloc(sizeof(*rec)))) goto fail;
+    if (mtx_init(&rec->write_mutex, mtx_plain) != thrd_success) goto write_mutex_fail;
+    rec->out   = out;
+    rec->buf   = rec->bufs[0];
+    rec->spare = rec->bufs[1];
+    rec->len   = 0;
+    rec->error = 0;
+
+    unsigned char header[16];
+    memcpy(header, RECORD_MAGIC, 8);
+    put_le(header +  8, RECORD_VERSION, 4);
+    put_le(header + 12, RECORD_SIZE,    4);
+    if (fwrite(header, 1, sizeof(header), out) != sizeof(header)) goto header_fail;
+
+    rec->start_ns = now_ns();
+    atomic_store_explicit(&pool->recorder, rec, memory_order_relaxed);
+    mtx_unlock(&pool->record_mutex);
+    return 0;
+
+header_fail:
+    mtx_destroy(&rec->write_mutex);
+write_mutex_fail:
+    free(rec);
+fail:
+    mtx_unlock(&pool->record_mutex);
+    return 1;
+}
+
+int
+cpool_record_stop(cpool* pool)
+{
+    mtx_lock(&pool->record_mutex);
+    cpool_recorder* rec = atomic_load_explicit(&pool->recorder, memory_order_relaxed);
+    atomic_store_explicit(&pool->recorder, NULL, memory_order_relaxed);
+    mtx_unlock(&pool->record_mutex);
+    if (!rec) return 0;
+
+    /* workers which saw the recorder took `write_mutex` before unlocking, wait for their writes */
+    mtx_lock(&rec->write_mutex);
+    recorder_write(rec, rec->buf, rec->len);
+    if (fflush(rec->out)) rec->error = 1;
+    int error = rec->error;
+    mtx_unlock(&rec->write_mutex);
+    mtx_destroy(&rec->write_mutex);
+    free(rec);
+    return error;
+}
+
+int
+cpool_record_read_header(FILE* in)
+{
+    unsigned char header[16];
+    if (fread(header, 1, sizeof(header), in) != sizeof(header)) return 1;
+    if (memcmp(header, RECORD_MAGIC, 8) != 0
+        || get_le(header + 8, 4) != RECORD_VERSION
+        || get_le(header + 12, 4) != RECORD_SIZE) return 1;
+    return 0;
+}
+
+int
+cpool_record_read(FILE* in, cpool_record* record)
+{
+    unsigned char buf[RECORD_SIZE];
+    if (fread(buf, 1, sizeof(buf), in) != sizeof(buf)) return 1;
+    record->enqueue_ns = get_le(buf,      8);
+    record->wait_ns    = get_le(buf +  8, 8);
+    record->run_ns     = get_le(buf + 16, 8);
+    record->func       = get_le(buf + 24, 8);
+    record->thread     = (unsigned)get_le(buf + 32, 4);
+    record->worker     = (unsigned)get_le(buf + 36, 4);
+    return 0;
 }
@@ -2,11 +2,17 @@
 #define CPOOL_H
 
 #include <stddef.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* With CPOOL_INLINE defined, lock-free fast paths are inlined (C only), see the end of this file. */
+#if defined(CPOOL_INLINE) && !defined(__cplusplus)
+#define CPOOL_INLINE_FAST_PATHS 1
+#endif
+
 /* job function type */
 typedef void (*cpool_func_t)(void*);
 
@@ -16,6 +22,143 @@ typedef struct cpool cpool;
 /* opaque future object */
 typedef struct cpool_future cpool_future;
 
+/**
+ * @brief Watchdog callback, called when a job has been running for longer than the threshold.
+ *
+ * Called once per such job, from the watchdog thread.
+ *
+ * @param[in] arg        `watchdog_arg` of the pool attributes
+ * @param[in] worker     Index of the worker running the job
+ * @param[in] func       Function of the job
+ * @param[in] elapsed_ns Time the job has been running, in nanoseconds
+ */
+typedef void (*cpool_watchdog_func_t)(void* arg, size_t worker, cpool_func_t func, unsigned long long elapsed_ns);
+
+/* Scheduling policy of worker threads */
+typedef enum {
+    CPOOL_SCHED_INHERIT, /* keep the policy inherited from the creating thread (default) */
+    CPOOL_SCHED_OTHER,
+    CPOOL_SCHED_BATCH,   /* Linux only */
+    CPOOL_SCHED_IDLE,    /* Linux only */
+    CPOOL_SCHED_FIFO,    /* realtime, uses `sched_priority` */
+    CPOOL_SCHED_RR       /* realtime, uses `sched_priority` */
+} cpool_sched_policy;
+
+/* Ordering policy of the job queue */
+typedef enum {
+    CPOOL_QUEUE_FIFO,     /* first in, first out (default) */
+    CPOOL_QUEUE_LIFO,     /* last in, first out */
+    CPOOL_QUEUE_PRIORITY  /* lowest key first, FIFO among equal keys. See `cpool_enqueue_key()`.
+                           * With deadlines as keys, this is earliest-deadline-first (EDF).
+                           */
+} cpool_queue_policy;
+
+/* Huge page backing of pool-owned memory, such as the job queue */
+typedef enum {
+    CPOOL_HUGEPAGES_NONE,    /* regular allocation (default) */
+    CPOOL_HUGEPAGES_ADVISE,  /* huge page aligned mapping, advised for transparent huge pages (Linux) */
+    CPOOL_HUGEPAGES_HUGETLB  /* explicit 2 MiB huge pages (MAP_HUGETLB, Linux), whatever the default huge page size,
+                              * falling back to CPOOL_HUGEPAGES_ADVISE
+                              */
+} cpool_hugepages;
+
+/* Synchronization engine of the job queue */
+typedef enum {
+    CPOOL_ENGINE_MUTEX,     /* every enqueue takes the pool mutex (default) */
+    CPOOL_ENGINE_COMBINING, /* Flat combining: enqueues are published in per-thread slots, and applied in
+                             * batches by whichever thread holds the mutex, producer or worker.
+                             * Fewer mutex handoffs under contention, at the cost of spinning producers.
+                             */
+    CPOOL_ENGINE_ADAPTIVE,  /* Switches between the two at runtime: to combining when enqueues often find the mutex
+                             * taken, and back to the mutex when combined batches are mostly single jobs.
+                             */
+    CPOOL_ENGINE_PERCPU     /* Per-CPU shards (Linux): enqueues push onto a small shard of the current CPU under its
+                             * own lock, without touching the mutex, and workers move shards to the queue in batches.
+                             * Falls back to the mutex when the shard is full or busy, and on other platforms.
+                             */
+} cpool_engine;
+
+/* Pool creation attributes. Initialize with `cpool_attr_init()`, then adjust as needed. */
+typedef struct {
+    size_t nb_workers;   /* Number of worker threads. Must be positive. */
+    size_t max_jobs;     /* Capacity of the job queue. Must be positive. */
+    cpool_queue_policy queue_policy;
+    cpool_engine engine;
+    const struct cpool_scheduler_ops* scheduler; /* Custom job queue, replacing `queue_policy` if not NULL.
+                                                  * See `cpool_scheduler_ops`. Must outlive the pool.
+                                                  */
+    void* scheduler_arg;                         /* passed to `scheduler->create()` */
+    cpool_hugepages hugepages; /* Falls back silently to regular allocation where unavailable.
+                                * Mappings are rounded up to the huge page size (2 MiB).
+                                */
+    int cache_domains;   /* Partition the queue by L3 cache domain (Linux only), see the README.
+                          * Ignored with a custom scheduler, or fewer workers than domains.
+                          */
+    const char* name;    /* Pool name, may be NULL. Workers are named "<name>-<index>",
+                          * with the name shortened to fit the OS limit (15 characters on Linux),
+                          * and metrics are labeled with it by default. The string is copied.
+                          */
+
+    /* Worker scheduling, applied by each worker when it starts.
+     * Settings the process lacks privileges for (e.g. realtime policies, negative nice values)
+     * are silently skipped, leaving the inherited ones in effect.
+     */
+    cpool_sched_policy sched_policy;
+    int sched_priority;  /* realtime priority, clamped to the valid range of the policy */
+    int sched_nice;      /* nice value of workers (Linux only). 0 leaves it unchanged. */
+
+    /* Job watchdog. Disabled if `watchdog_threshold_ns` is 0 (default). */
+    unsigned long long watchdog_threshold_ns;    /* report jobs running for longer than this */
+    unsigned long long watchdog_interval_ns;     /* period of checks. Defaults to a quarter of the threshold. */
+    cpool_watchdog_func_t watchdog_func;         /* may be NULL */
+    void* watchdog_arg;
+    size_t watchdog_max_replacements;            /* Number of times a worker stuck in a reported job may be
+                                                  * replaced by a new worker, keeping the pool's capacity.
+                                                  * The stuck worker exits once its job returns.
+                                                  */
+} cpool_attr;
+
+/* A job in a recorded workload. Times are in nanoseconds. */
+typedef struct {
+    unsigned long long enqueue_ns; /* time of enqueue, relative to the start of recording */
+    unsigned long long wait_ns;    /* time spent in the queue */
+    unsigned long long run_ns;     /* run time */
+    unsigned long long func;       /* address of the job function, identifying it within one process */
+    unsigned thread;               /* enqueuing thread, numbered from 1 in order of first enqueue */
+    unsigned worker;               /* index of the worker which ran the job */
+} cpool_record;
+
+/* call sites acquiring the pool mutex, for contention profiling */
+typedef enum {
+    CPOOL_SITE_ENQUEUE,  /* cpool_enqueue() */
+    CPOOL_SITE_DEQUEUE,  /* worker taking a job */
+    CPOOL_SITE_COMPLETE, /* worker finishing a job */
+    CPOOL_SITE_WAIT,     /* cpool_wait() */
+    CPOOL_SITE_OTHER,    /* stop, metrics, etc. */
+    CPOOL_SITE_COUNT
+} cpool_site;
+
+/* condition variables of the pool, for contention profiling */
+typedef enum {
+    CPOOL_COND_WORK,     /* workers waiting for jobs */
+    CPOOL_COND_ENQUEUE,  /* enqueue waiting for a free slot */
+    CPOOL_COND_IDLE,     /* cpool_wait() waiting for the pool to become idle */
+    CPOOL_COND_COUNT
+} cpool_cond;
+
+/* Contention profile of a pool. Times are in nanoseconds. */
+typedef struct {
+    struct {
+        unsigned long long acquired;  /* number of acquisitions */
+        unsigned long long contended; /* acquisitions where the initial try-lock failed */
+        unsigned long long wait_ns;   /* time blocked in contended acquisitions */
+    } site[CPOOL_SITE_COUNT];
+    struct {
+        unsigned long long waits;
+        unsigned long long wait_ns;   /* time spent in the wait, including re-acquiring the mutex */
+    } cond[CPOOL_COND_COUNT];
+} cpool_contention;
+
 /**
  * @brief Allocate and initialize a thread pool.
  *
@@ -25,6 +168,51 @@ typedef struct cpool_future cpool_future;
  */
 cpool* cpool_create(size_t nb_workers, size_t max_jobs);
 
+/**
+ * @brief Initialize pool attributes with defaults.
+ */
+void cpool_attr_init(cpool_attr* attr, size_t nb_workers, size_t max_jobs);
+
+/**
+ * @brief Allocate and initialize a thread pool, with attributes.
+ *
+ * @return A pointer to an initialized pool, or NULL on failure.
+ */
+cpool* cpool_create_ex(const cpool_attr* attr);
+
+/**
+ * @brief Size of the memory needed by `cpool_init()`, for the pool, its workers and job queue.
+ *
+ * @return the size in bytes, or 0 if it overflows.
+ */
+size_t cpool_required_size(size_t nb_workers, size_t max_jobs);
+
+/**
+ * @brief Same as `cpool_required_size()`, for `cpool_init_ex()` with attributes.
+ */
+size_t cpool_required_size_ex(const cpool_attr* attr);
+
+/**
+ * @brief Create a thread pool in caller-provided memory, without heap allocation.
+ *
+ * The pool, its workers and its job queue are laid out in `mem`, e.g. memory on huge pages or local to a NUMA node.
+ * The pool behaves as one from `cpool_create()`. `cpool_destroy()` does not free `mem`, which must
+ * outlive the pool.
+ *
+ * @param[in] mem      Memory of at least `cpool_required_size()` bytes, aligned to 64 bytes (a cache line),
+ *                     e.g. from `aligned_alloc(64, size)`.
+ * @param[in] mem_size Size of `mem`
+ * @return pointer to the pool, at `mem`. NULL on error, including if `mem_size` is too small,
+ *         or `mem` is misaligned.
+ */
+cpool* cpool_init(void* mem, size_t mem_size, size_t nb_workers, size_t max_jobs);
+
+/**
+ * @brief Same as `cpool_init()`, with attributes. The `hugepages` attribute is ignored,
+ *        as placement is up to the caller.
+ */
+cpool* cpool_init_ex(void* mem, size_t mem_size, const cpool_attr* attr);
+
 /**
  * @brief Request stop, wait for workers to exit, clean-up resources, and finally return.
  */
@@ -53,6 +241,141 @@ void cpool_destroy(cpool* pool);
  */
 int cpool_enqueue(cpool* pool, cpool_func_t func, void* data, cpool_future** future);
 
+/**
+ * @brief Same as `cpool_enqueue()`, with an ordering key for the CPOOL_QUEUE_PRIORITY policy.
+ *
+ * Jobs with lower keys are run first. The key is ignored by other policies,
+ * and `cpool_enqueue()` uses a key of 0.
+ */
+int cpool_enqueue_key(cpool* pool, cpool_func_t func, void* data, unsigned long long key, cpool_future** future);
+
+/**
+ * @brief Data to prefetch before a job runs, see `cpool_enqueue_prefetch()`.
+ *
+ * Either `func` is set, or the range `addr`, `len`. Ranges are capped to 4 KiB.
+ */
+typedef struct {
+    const void* addr;      /* start of the range to prefetch */
+    size_t len;            /* length of the range, in bytes */
+    void (*func)(void*);   /* if not NULL, called with the job's `data` to issue prefetches itself,
+                            * e.g. with `__builtin_prefetch()` along a pointer chain.
+                            */
+} cpool_prefetch;
+
+/**
+ * @brief Same as `cpool_enqueue()`, with data to prefetch before the job runs.
+ *
+ * When a worker dequeues a job, it prefetches that job's data, and the range of the job next in the queue
+ * before running its own, so the next job's data is in (shared) cache by the time a worker starts it.
+ *
+ * @param[in] prefetch Data to prefetch, copied. May be NULL.
+ *
+ * @note `prefetch->func` is only called by the worker about to run the job, before running it.
+ *       The next job may run and free its data on another worker meanwhile, so only its range is
+ *       prefetched, which is safe even if it has been freed.
+ */
+int cpool_enqueue_prefetch(cpool* pool, cpool_func_t func, void* data, const cpool_prefetch* prefetch,
+                           cpool_future** future);
+
+/**
+ * @brief Queued job, as stored by schedulers. See `cpool_scheduler_ops`.
+ *
+ * Schedulers order jobs by the public members, and store and return jobs whole.
+ */
+typedef struct {
+    cpool_func_t func;
+    void* data;
+    cpool_future* future;          /* future of the job, may be NULL */
+    unsigned long long enqueue_ns; /* time of enqueue, on the pool's monotonic clock */
+    unsigned long long key;        /* key of `cpool_enqueue_key()`, 0 otherwise */
+
+    /* private to the pool */
+    unsigned long long seq;
+    union {
+        const void* addr;
+        void (*func)(void*);
+    } prefetch;                    /* see `cpool_enqueue_prefetch()`, the one of the two `prefetch_len` tells */
+    unsigned submitter;
+    unsigned short prefetch_len;
+    unsigned char epoch;
+    unsigned char domain;
+} cpool_job;
+
+/**
+ * @brief Custom job queue of a pool, selected with the `scheduler` attribute.
+ *
+ * The pool keeps parking, statistics and futures, and calls these operations with its mutex held,
+ * so schedulers need no synchronization of their own. The pool never holds more than `capacity`
+ * jobs in a scheduler: enqueues block while it is full. Every pushed job must be popped exactly once.
+ */
+typedef struct cpool_scheduler_ops {
+    void* (*create)(void* arg, size_t capacity); /* scheduler state, or NULL on failure */
+    void (*destroy)(void* sched);
+    void (*push)(void* sched, const cpool_job* job);
+    /* Push `nb_jobs` jobs at once, e.g. to sort them once. Optional, defaults to repeated `push()`. */
+    void (*push_batch)(void* sched, const cpool_job* jobs, size_t nb_jobs);
+    void (*pop)(void* sched, cpool_job* job);   /* next job to run. Only called if `size()` is positive. */
+    size_t (*size)(void* sched);                /* number of queued jobs */
+    void (*on_idle)(void* sched);               /* a worker found no job and is parking. Optional. */
+} cpool_scheduler_ops;
+
+/**
+ * @brief Intrusive job node, embedded by the user in their own object. See `cpool_enqueue_node()`.
+ */
+typedef struct cpool_node {
+    cpool_func_t func;              /* job function, called with the node itself as argument */
+
+    /* private to the pool */
+    struct cpool_node* next;
+    unsigned long long enqueue_ns;
+    unsigned submitter, epoch;
+} cpool_node;
+
+/**
+ * @brief Enqueue a job embedded in a user object, without copying nor allocation.
+ *
+ * Nodes are pushed lock-free to an unbounded list, so this never blocks.
+ * Once started, `node->func` receives `node`, from which the enclosing object can be recovered,
+ * e.g. with `offsetof()`. The node must stay valid, and must not be enqueued again, until then.
+ *
+ * Nodes are run in enqueue order with respect to each other, interleaved with jobs from the queue.
+ * Nodes accepted concurrently with `cpool_stop()` are run by `cpool_destroy()` at the latest.
+ *
+ * @return 0 on success, 1 if pool is stopped.
+ */
+#ifndef CPOOL_INLINE_FAST_PATHS
+int cpool_enqueue_node(cpool* pool, cpool_node* node);
+#endif
+
+/**
+ * @brief Caller-owned storage of a future, e.g. on the stack. See `cpool_future_init()`.
+ */
+typedef union {
+    unsigned char bytes[128];
+    void* align_ptr;
+    long long align_ll;
+    long double align_ld;
+} cpool_future_storage;
+
+/**
+ * @brief Initialize a future in caller-owned storage, for `cpool_enqueue_future()`.
+ *
+ * The storage must outlive the job, and stay in place until the future is consumed by `cpool_wait_future()`,
+ * which releases the future without freeing the storage. It can then be initialized again.
+ *
+ * @return the future, or NULL if its initialization failed.
+ */
+cpool_future* cpool_future_init(cpool_future_storage* storage);
+
+/**
+ * @brief Same as `cpool_enqueue()`, with a future initialized by `cpool_future_init()`, without allocation.
+ *
+ * @param[in] future Future associated with the job, *MUST* be consumed by `cpool_wait_future()` on success.
+ *                   It is released if the enqueue fails.
+ * @return 0 on success, 1 if pool is stopped.
+ */
+int cpool_enqueue_future(cpool* pool, cpool_func_t func, void* data, cpool_future* future);
+
 /**
  * @brief Wait until all jobs are finished, i.e. no worker is doing work and job queue is empty.
  *
@@ -60,6 +383,19 @@ int cpool_enqueue(cpool* pool, cpool_func_t func, void* data, cpool_future** fut
  */
 void cpool_wait(cpool* pool);
 
+/**
+ * @brief Wait until all jobs enqueued before the call are finished.
+ *
+ * Unlike `cpool_wait()`, this does not wait for all jobs enqueued during the call,
+ * so it returns under continuous load.
+ *
+ * @note Jobs are grouped in epochs, and a call waits for the whole epoch current when it is made.
+ *       A new epoch only starts once the previous one is finished: with concurrent calls, a call made
+ *       while an earlier one still waits also waits for the jobs enqueued until the earlier call's epoch
+ *       is finished, which join its own epoch. This extra wait is bounded by the earlier call's.
+ */
+void cpool_wait_submitted(cpool* pool);
+
 /**
  * @brief Wait on the future handle, returning when the associated job has finished.
  * 
@@ -67,6 +403,26 @@ void cpool_wait(cpool* pool);
  */
 void cpool_wait_future(cpool_future* future);
 
+/**
+ * @brief Check whether the job associated with a future has finished, without waiting.
+ *
+ * The future must still be consumed by `cpool_wait_future()`, which then returns without waiting.
+ */
+#ifndef CPOOL_INLINE_FAST_PATHS
+int cpool_future_done(const cpool_future* future);
+#endif
+
+/**
+ * @brief Warm up the pool, avoiding the slower first jobs after creation.
+ *
+ * Prefaults the job queue, and runs a warm-up job on every worker, faulting in stack pages and
+ * initializing the thread's allocator state. Returns once all workers are idle.
+ * Meant to be called after creation, before enqueuing jobs: it waits for every worker to take a warm-up job.
+ *
+ * @return 0 on success, 1 if pool is stopped.
+ */
+int cpool_warmup(cpool* pool);
+
 /**
  * Request stop.
  *
@@ -76,6 +432,156 @@ void cpool_wait_future(cpool_future* future);
  */
 void cpool_stop(cpool* pool);
 
+/**
+ * @brief Write metrics of one or more pools in OpenMetrics text format.
+ *
+ * Exposes queue depth and capacity, busy/idle workers, enqueued/completed job counters,
+ * time enqueue spent blocked on a full queue, and histograms of job queue wait and run time.
+ * Every sample is labeled with `pool="<name>"`. The output is a complete exposition
+ * terminated by `# EOF`, suitable as the body of a scrape response.
+ *
+ * @param[in] pools    Array of `nb_pools` pools.
+ * @param[in] names    Array of `nb_pools` pool names used as label values. May be NULL,
+ *                     and NULL elements default to the names the pools were created with.
+ * @param[in] nb_pools Number of pools.
+ * @param[in] out      Output stream.
+ * @return 0 on success, 1 on allocation or output error.
+ */
+int cpool_metrics_write(cpool* const* pools, const char* const* names, size_t nb_pools, FILE* out);
+
+/**
+ * @brief Same as `cpool_metrics_write()`, but renders into a buffer, with `snprintf()` semantics.
+ *
+ * @return Length of the full output, excluding the terminating null character.
+ *         If it is not less than `size`, the output was truncated. 0 on error.
+ */
+size_t cpool_metrics_snprint(char* buf, size_t size, cpool* const* pools, const char* const* names, size_t nb_pools);
+
+/**
+ * @brief Start recording the workload of the pool to a binary stream.
+ *
+ * Every job enqueued after this call is recorded on completion, in completion order,
+ * as a `cpool_record`. Records are buffered, and written to `out` from worker threads.
+ * The stream is a 16 byte header followed by 40 byte records, all integers little-endian;
+ * read it with `cpool_record_read_header()` and `cpool_record_read()`.
+ * Replay a recording against a pool with `tools/cpool_replay.c`.
+ *
+ * @param[in] out Stream opened in binary mode. It must stay valid until recording is stopped.
+ * @return 0 on success, 1 on error or if the pool is already recording.
+ */
+int cpool_record_start(cpool* pool, FILE* out);
+
+/**
+ * @brief Stop recording, flushing buffered records. Does nothing if the pool is not recording.
+ *
+ * Recording is also stopped on `cpool_destroy()`.
+ *
+ * @return 0 on success, 1 if writing any record failed.
+ */
+int cpool_record_stop(cpool* pool);
+
+/**
+ * @brief Read and validate the header of a recording.
+ *
+ * @return 0 on success, 1 on error or if the stream is not a supported recording.
+ */
+int cpool_record_read_header(FILE* in);
+
+/**
+ * @brief Read the next record of a recording.
+ *
+ * @return 0 on success, 1 at end of stream or on error.
+ */
+int cpool_record_read(FILE* in, cpool_record* record);
+
+/**
+ * @brief Retrieve the OS thread IDs of the workers, for use with external profilers and cgroup tools.
+ *
+ * Only workers serving the queue are included, i.e. not those replaced by the watchdog.
+ * A worker replacement launched very recently may report a thread ID of 0 until it has started.
+ *
+ * @param[out] out Array receiving up to `max` thread IDs.
+ * @param[in]  max Capacity of `out`.
+ * @return Number of workers, which may exceed `max`. 0 on platforms other than Linux.
+ */
+size_t cpool_worker_tids(cpool* pool, long* out, size_t max);
+
+/**
+ * @brief Retrieve the contention profile of the pool mutex and condition variables.
+ *
+ * Profiling is only available if cpool was built with `CPOOL_PROFILE_CONTENTION` defined.
+ * When it is, the profile is also included in the output of `cpool_metrics_write()`.
+ *
+ * @return 0 on success, 1 if profiling is not available, in which case `*out` is zeroed.
+ */
+int cpool_contention_get(cpool* pool, cpool_contention* out);
+
+/**
+ * @brief Print a human-readable contention report, with contention ratios per call site.
+ *
+ * @return 0 on success, 1 if profiling is not available or on output error.
+ */
+int cpool_contention_print(cpool* pool, FILE* out);
+
+/* Private to the pool: only declared for the inline fast paths, and for cpool.c, which defines
+ * CPOOL_INTERNAL_, so that other includers need neither C11 atomics nor <stdatomic.h>.
+ */
+#if defined(CPOOL_INLINE_FAST_PATHS) || (defined(CPOOL_INTERNAL_) && !defined(__cplusplus))
+#include <stdatomic.h>
+
+/* Leading members of `struct cpool` and `struct cpool_future`, for the inline fast paths. */
+typedef struct {
+    atomic_int stop;
+    _Atomic(cpool_node*) nodes_in;
+    atomic_size_t nb_parked;
+    atomic_int asym_fence;
+    atomic_int nodes_used;
+} cpool_inline_pool_;
+
+typedef struct {
+    atomic_int flag;
+} cpool_inline_future_;
+
+/* Slow path of `cpool_enqueue_node()`: wake a worker which may be parked. */
+void cpool_wake_parked_(cpool* pool);
+/* Slow path of the first `cpool_enqueue_node()` of a pool: mark the pool as having lock-free producers. */
+void cpool_use_nodes_(cpool* pool);
+#endif
+
+#ifdef CPOOL_INLINE_FAST_PATHS
+/* Inline fast paths, sharing the documentation of the declarations above.
+ * Nodes enqueued inline are timestamped when taken by a worker, and not attributed to a submitter thread.
+ * These are C99 inline definitions: the external definitions, for calls which are not inlined and for
+ * C++ callers, are emitted by cpool.c, with or without `CPOOL_INLINE`.
+ */
+
+inline int
+cpool_future_done(const cpool_future* future)
+{
+    return atomic_load_explicit(&((const cpool_inline_future_*)(const void*)future)->flag, memory_order_acquire);
+}
+
+inline int
+cpool_enqueue_node(cpool* pool, cpool_node* node)
+{
+    cpool_inline_pool_* shared = (cpool_inline_pool_*)(void*)pool;
+    if (atomic_load_explicit(&shared->stop, memory_order_relaxed)) return 1;
+    if (!atomic_load_explicit(&shared->nodes_used, memory_order_acquire)) cpool_use_nodes_(pool);
+    node->enqueue_ns = 0;
+    node->submitter  = 0;
+    cpool_node* head = atomic_load_explicit(&shared->nodes_in, memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&shared->nodes_in, &head, node,
+                                                    memory_order_release, memory_order_relaxed));
+    /* order the push before reading `nb_parked`, see fence_light() in cpool.c */
+    if (atomic_load_explicit(&shared->asym_fence, memory_order_acquire)) atomic_signal_fence(memory_order_seq_cst);
+    else atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&shared->nb_parked, memory_order_relaxed)) cpool_wake_parked_(pool);
+    return 0;
+}
+#endif /* CPOOL_INLINE_FAST_PATHS */
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,134 @@
+#ifndef CPOOL_QUEUE_H
+#define CPOOL_QUEUE_H
+
+/*
+ * Job queue policies, shared by the pool (cpool.c) and the scheduling simulator (tools/cpool_sim.c),
+ * so that simulated results transfer to the pool.
+ *
+ * Queues are not synchronized, and have a fixed capacity.
+ * Callers check `count` against `capacity` before pushing, and against 0 before popping.
+ */
+
+#include "cpool.h"
+#include <stdint.h>
+
+/* Queued job. Fields used by the pool only: `submitter`, for workload recording, `epoch`, the parity of
+ * the submission epoch for cpool_wait_submitted(), `domain`, the cache domain it was enqueued from,
+ * `prefetch` and `prefetch_len`, packed from the descriptor of cpool_enqueue_prefetch(), and `seq`,
+ * queue-private insertion order, breaking ties between equal keys.
+ */
+typedef cpool_job cpool_work;
+
+typedef struct {
+    cpool_queue_policy policy;
+    cpool_work* items;
+    size_t capacity, count;
+    size_t first;         /* ring buffer (FIFO, LIFO): index of the front item */
+    uint64_t seq;         /* heap (PRIORITY): insertion counter */
+} cpool_queue;
+
+/* Initialize a queue on caller-owned storage for `capacity` items. */
+static inline void
+queue_init(cpool_queue* q, cpool_queue_policy policy, cpool_work* items, size_t capacity)
+{
+    q->policy   = policy;
+    q->items    = items;
+    q->capacity = capacity;
+    q->count    = 0;
+    q->first    = 0;
+    q->seq      = 0;
+}
+
+/* Ring buffer operations, also used directly as a deque by the simulated work-stealing policy. */
+
+static inline void
+ring_push_back(cpool_queue* q, const cpool_work* work)
+{
+    q->items[(q->first + q->count) % q->capacity] = *work;
+    q->count += 1;
+}
+
+static inline void
+ring_pop_front(cpool_queue* q, cpool_work* work)
+{
+    *work = q->items[q->first];
+    q->first = (q->first + 1) % q->capacity;
+    q->count -= 1;
+}
+
+static inline void
+ring_pop_back(cpool_queue* q, cpool_work* work)
+{
+    q->count -= 1;
+    *work = q->items[(q->first + q->count) % q->capacity];
+}
+
+/* Binary min-heap on (key, seq). */
+
+static inline int
+heap_less(const cpool_work* a, const cpool_work* b)
+{
+    return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+static inline void
+heap_push(cpool_queue* q, const cpool_work* work)
+{
+    size_t i = q->count++;
+    cpool_work item = *work;
+    item.seq = q->seq++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!heap_less(&item, q->items + parent)) break;
+        q->items[i] = q->items[parent];
+        i = parent;
+    }
+    q->items[i] = item;
+}
+
+static inline void
+heap_pop(cpool_queue* q, cpool_work* work)
+{
+    *work = q->items[0];
+    cpool_work last = q->items[--q->count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= q->count) break;
+        if (child + 1 < q->count && heap_less(q->items + child + 1, q->items + child)) ++child;
+        if (!heap_less(q->items + child, &last)) break;
+        q->items[i] = q->items[child];
+        i = child;
+    }
+    q->items[i] = last;
+}
+
+static inline void
+queue_push(cpool_queue* q, const cpool_work* work)
+{
+    if (q->policy == CPOOL_QUEUE_PRIORITY) heap_push(q, work);
+    else ring_push_back(q, work);
+}
+
+/* Item the next queue_pop() returns, without removing it. The queue must not be empty. */
+static inline const cpool_work*
+queue_peek(const cpool_queue* q)
+{
+    switch (q->policy) {
+    case CPOOL_QUEUE_LIFO:     return q->items + (q->first + q->count - 1) % q->capacity;
+    case CPOOL_QUEUE_PRIORITY: return q->items;
+    default:                   return q->items + q->first;
+    }
+}
+
+static inline void
+queue_pop(cpool_queue* q, cpool_work* work)
+{
+    switch (q->policy) {
+    case CPOOL_QUEUE_LIFO:     ring_pop_back(q, work);  break;
+    case CPOOL_QUEUE_PRIORITY: heap_pop(q, work);       break;
+    default:                   ring_pop_front(q, work); break;
+    }
+}
+
+#endif /* CPOOL_QUEUE_H */
@@ -0,0 +1,84 @@
+#ifndef CPOOL_SDT_H
+#define CPOOL_SDT_H
+
+/*
+ * USDT (statically defined tracing) probes, compatible with SystemTap's <sys/sdt.h>,
+ * usable from bpftrace, perf, and SystemTap, e.g.
+ *
+ *     bpftrace -e 'usdt:./libcpool.so:cpool:job_end { @run_ns = hist(arg3); }'
+ *
+ * This is a self-contained subset of <sys/sdt.h>: it only emits a `nop` at the probe site and a
+ * `.note.stapsdt` ELF note describing it, so there is no runtime dependency.
+ * Every probe has a semaphore, which tracers increment while attached. `CPOOL_TRACE()` checks it,
+ * so probe arguments are only computed while a probe is attached.
+ *
+ * All arguments are passed as 64-bit unsigned integers.
+ * Probes are only emitted on x86-64 ELF targets with GCC-compatible compilers,
+ * and can be disabled by defining `CPOOL_NO_USDT`.
+ *
+ * Intended for inclusion by cpool.c only.
+ */
+
+#if defined(__x86_64__) && defined(__ELF__) && defined(__GNUC__) && !defined(CPOOL_NO_USDT)
+
+#define CPOOL_SDT_SEMAPHORE(name) cpool_##name##_semaphore
+
+/* Define the semaphore of a probe. Must appear once, at file scope, for each probe. */
+#define CPOOL_SDT_DEFINE(name) \
+    __attribute__((used, section(".probes"), visibility("hidden"))) \
+    volatile unsigned short CPOOL_SDT_SEMAPHORE(name)
+
+#define CPOOL_SDT_ENABLED(name) __builtin_expect(CPOOL_SDT_SEMAPHORE(name) != 0, 0)
+
+#define CPOOL_SDT_ARG(n, x) [cpool_sdt_a##n] "nor" ((unsigned long long)(x))
+
+#define CPOOL_SDT_ASM(name, args, ...) \
+    __asm__ __volatile__ ( \
+        "990: nop\n" \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+        ".balign 4\n" \
+        ".4byte 992f-991f, 994f-993f, 3\n" \
+        "991: .asciz \"stapsdt\"\n" \
+        "992: .balign 4\n" \
+        "993: .8byte 990b\n" \
+        ".8byte _.stapsdt.base\n" \
+        ".8byte cpool_" #name "_semaphore\n" \
+        ".asciz \"cpool\"\n" \
+        ".asciz \"" #name "\"\n" \
+        ".asciz \"" args "\"\n" \
+        "994: .balign 4\n" \
+        ".popsection\n" \
+        ".ifndef _.stapsdt.base\n" \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+        ".weak _.stapsdt.base\n" \
+        ".hidden _.stapsdt.base\n" \
+        "_.stapsdt.base: .space 1\n" \
+        ".size _.stapsdt.base, 1\n" \
+        ".popsection\n" \
+        ".endif\n" \
+        :: __VA_ARGS__)
+
+#define CPOOL_SDT_PROBE1(name, x1) \
+    CPOOL_SDT_ASM(name, "8@%[cpool_sdt_a1]", CPOOL_SDT_ARG(1, x1))
+#define CPOOL_SDT_PROBE2(name, x1, x2) \
+    CPOOL_SDT_ASM(name, "8@%[cpool_sdt_a1] 8@%[cpool_sdt_a2]", CPOOL_SDT_ARG(1, x1), CPOOL_SDT_ARG(2, x2))
+#define CPOOL_SDT_PROBE3(name, x1, x2, x3) \
+    CPOOL_SDT_ASM(name, "8@%[cpool_sdt_a1] 8@%[cpool_sdt_a2] 8@%[cpool_sdt_a3]", \
+                  CPOOL_SDT_ARG(1, x1), CPOOL_SDT_ARG(2, x2), CPOOL_SDT_ARG(3, x3))
+#define CPOOL_SDT_PROBE4(name, x1, x2, x3, x4) \
+    CPOOL_SDT_ASM(name, "8@%[cpool_sdt_a1] 8@%[cpool_sdt_a2] 8@%[cpool_sdt_a3] 8@%[cpool_sdt_a4]", \
+                  CPOOL_SDT_ARG(1, x1), CPOOL_SDT_ARG(2, x2), CPOOL_SDT_ARG(3, x3), CPOOL_SDT_ARG(4, x4))
+
+/* Fire probe `name` with `n` arguments, evaluating them only if a tracer is attached. */
+#define CPOOL_TRACE(name, n, ...) \
+    do { if (CPOOL_SDT_ENABLED(name)) CPOOL_SDT_PROBE##n(name, __VA_ARGS__); } while (0)
+
+#else
+
+#define CPOOL_SDT_DEFINE(name) struct cpool_sdt_unused_##name
+#define CPOOL_SDT_ENABLED(name) 0
+#define CPOOL_TRACE(name, n, ...) ((void)0)
+
+#endif
+
+#endif /* CPOOL_SDT_H */
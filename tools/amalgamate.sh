@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Generate a single-header (stb-style) build of cpool, from cpool.h, cpool.c and its internal headers.
+#
+# The generated header declares the API, with the lock-free fast paths inlined (`CPOOL_INLINE`).
+# In exactly one C source file, define `CPOOL_IMPLEMENTATION` before including it, as the first
+# include of the file, for the implementation.
+#
+# Usage: tools/amalgamate.sh [output]    (default: cpool_single.h)
+
+set -e
+cd "$(dirname "$0")/.."
+out=${1:-cpool_single.h}
+
+strip_local_includes() {
+    grep -v '^#include "cpool' "$1"
+}
+
+{
+    echo '/* Single-header build of cpool, generated by tools/amalgamate.sh. Do not edit. */'
+    echo
+    echo '#if defined(CPOOL_IMPLEMENTATION) && !defined(CPOOL_IMPLEMENTED)'
+    # feature test macros of cpool.c, which must precede any system header
+    sed -n '1,/^$/p' cpool.c
+    echo '#endif'
+    echo
+    echo '#ifndef CPOOL_INLINE'
+    echo '#define CPOOL_INLINE'
+    echo '#endif'
+    echo
+    cat cpool.h
+    echo
+    echo '#if defined(CPOOL_IMPLEMENTATION) && !defined(CPOOL_IMPLEMENTED)'
+    echo '#define CPOOL_IMPLEMENTED'
+    strip_local_includes cpool_sdt.h
+    strip_local_includes cpool_queue.h
+    sed '1,/^$/d' cpool.c | grep -v '^#include "cpool'
+    echo '#endif /* CPOOL_IMPLEMENTATION */'
+} > "$out"
@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# Check that the single header (tools/amalgamate.sh) builds and links: the implementation in a C file,
+# used from another C file, which inlines the fast paths, and from a C++ file, which calls their
+# external definitions.
+#
+# Usage: tools/check_single_header.sh    (CC and CXX default to cc and c++)
+
+set -e
+cd "$(dirname "$0")/.."
+CC=${CC:-cc}
+CXX=${CXX:-c++}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+tools/amalgamate.sh "$dir/cpool_single.h"
+
+cat > "$dir/impl.c" <<'EOF'
+#define CPOOL_IMPLEMENTATION
+#include "cpool_single.h"
+EOF
+
+cat > "$dir/use_c.c" <<'EOF'
+#include "cpool_single.h"
+
+static void
+job(void* arg)
+{
+    (void)arg;
+}
+
+int
+use_c(cpool* pool)
+{
+    static cpool_node node = { .func = job };
+    return cpool_enqueue_node(pool, &node);
+}
+EOF
+
+cat > "$dir/main.cpp" <<'EOF'
+#include "cpool_single.h"
+
+extern "C" int use_c(cpool* pool);
+
+static void
+job(void* arg)
+{
+    (void)arg;
+}
+
+int
+main()
+{
+    cpool* pool = cpool_create(2, 4);
+    if (!pool) return 1;
+    static cpool_node node;
+    node.func = job;
+    cpool_future* future = NULL;
+    int failed = cpool_enqueue_node(pool, &node) || use_c(pool) || cpool_enqueue(pool, job, NULL, &future);
+    cpool_wait(pool);
+    if (future) {
+        failed |= !cpool_future_done(future);
+        cpool_wait_future(future);
+    }
+    cpool_destroy(pool);
+    return failed;
+}
+EOF
+
+$CC -std=c11 -O2 -c "$dir/impl.c" -o "$dir/impl.o"
+$CC -std=c11 -O2 -c "$dir/use_c.c" -o "$dir/use_c.o"
+$CXX -std=c++11 -O2 -c "$dir/main.cpp" -o "$dir/main.o"
+$CXX "$dir/main.o" "$dir/use_c.o" "$dir/impl.o" -o "$dir/main" -lpthread
+"$dir/main"
+echo "single header: ok"
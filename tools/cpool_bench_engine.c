@@ -0,0 +1,301 @@
+/*
+ * Benchmark of enqueue synchronization under contention: the mutex, combining, adaptive and per-CPU
+ * engines (`cpool_attr.engine`), and lock-free intrusive nodes (`cpool_enqueue_node()`).
+ *
+ * Producer threads enqueue empty jobs as fast as possible, and the enqueue throughput is reported.
+ * Then, the cost of a single enqueue is measured without contention: one thread enqueues batches of
+ * COST_BATCH jobs while every worker is held busy, so that no worker is woken nor takes the lock.
+ * Last, the fences of lock-free enqueues are compared under bursty load: bursts of jobs, each followed by
+ * waiting for the pool to be idle, so that workers park after every burst. Parking workers issue
+ * membarrier() where producers only issue a compiler barrier, which pays off with long bursts; with short
+ * ones, the pool switches to full fences in producers, and issues few membarrier() calls.
+ * The costs of both fences are printed first: their ratio is the number of jobs per park above which
+ * membarrier() is cheaper. It grows with the number of CPUs running threads of the process.
+ *
+ * Build: cc -std=c11 -O2 -I. tools/cpool_bench_engine.c cpool.c -o cpool_bench_engine -lpthread
+ * Usage: cpool_bench_engine [producers] [workers] [jobs per producer] [max_jobs]
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* syscall() */
+#elif !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+#endif
+
+#include "cpool.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define COST_BATCH  16   /* jobs per batch of the cost measurement, fitting in a per-CPU shard */
+#define COST_ROUNDS 2000
+#define BURST_JOBS  (1u << 16) /* jobs per bursty load measurement */
+
+typedef struct {
+    cpool* pool;
+    size_t nb_jobs;
+    int nodes;
+    cpool_node* node_storage;
+} producer_arg;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void
+empty_job(void* arg)
+{
+    (void)arg;
+}
+
+static int
+producer(void* ptr)
+{
+    producer_arg* arg = ptr;
+    for (size_t i = 0; i < arg->nb_jobs; ++i) {
+        if (arg->nodes) {
+            arg->node_storage[i].func = empty_job;
+            cpool_enqueue_node(arg->pool, arg->node_storage + i);
+        } else {
+            cpool_enqueue(arg->pool, empty_job, NULL, NULL);
+        }
+    }
+    return 0;
+}
+
+static void
+run(const char* label, cpool_engine engine, int nodes, size_t nb_producers, size_t nb_workers,
+    size_t nb_jobs, size_t max_jobs)
+{
+    cpool_attr attr;
+    cpool_attr_init(&attr, nb_workers, max_jobs);
+    attr.engine = engine;
+    cpool* pool = cpool_create_ex(&attr);
+    thrd_t* threads = calloc(nb_producers, sizeof(*threads));
+    producer_arg* args = calloc(nb_producers, sizeof(*args));
+    if (!pool || !threads || !args) {
+        fprintf(stderr, "%s: allocation failed\n", label);
+        goto end;
+    }
+    for (size_t i = 0; i < nb_producers; ++i) {
+        args[i] = (producer_arg){ .pool = pool, .nb_jobs = nb_jobs, .nodes = nodes };
+        if (nodes && !(args[i].node_storage = calloc(nb_jobs, sizeof(cpool_node)))) {
+            fprintf(stderr, "%s: allocation failed\n", label);
+            goto end;
+        }
+    }
+
+    uint64_t start = now_ns();
+    size_t started = 0;
+    while (started < nb_producers && thrd_create(threads + started, producer, args + started) == thrd_success) {
+        ++started;
+    }
+    for (size_t i = 0; i < started; ++i) thrd_join(threads[i], NULL);
+    uint64_t enqueued = now_ns();
+    cpool_wait(pool);
+    uint64_t completed = now_ns();
+
+    double total = (double)started * nb_jobs;
+    printf("%-10s %12.0f enqueues/s %12.0f jobs/s\n", label,
+           total / ((enqueued - start) / 1e9), total / ((completed - start) / 1e9));
+end:
+    if (pool) cpool_destroy(pool);
+    if (args) {
+        for (size_t i = 0; i < nb_producers; ++i) free(args[i].node_storage);
+    }
+    free(args);
+    free(threads);
+}
+
+/* Gate holding workers busy in gate_job() until opened. */
+typedef struct {
+    mtx_t mutex;
+    cnd_t cond;
+    size_t arrived;
+    int open;
+} gate;
+
+static void
+gate_job(void* arg)
+{
+    gate* g = arg;
+    mtx_lock(&g->mutex);
+    g->arrived += 1;
+    cnd_broadcast(&g->cond);
+    while (!g->open) cnd_wait(&g->cond, &g->mutex);
+    mtx_unlock(&g->mutex);
+}
+
+/* Measure the cost of an uncontended enqueue: batches of COST_BATCH jobs, enqueued while all workers are
+ * held in gate_job(). Prints the average time of an enqueue.
+ */
+static void
+run_cost(const char* label, cpool_engine engine, int nodes, size_t nb_workers)
+{
+    cpool_attr attr;
+    cpool_attr_init(&attr, nb_workers, nb_workers + COST_BATCH);
+    attr.engine = engine;
+    cpool* pool = cpool_create_ex(&attr);
+    gate g = { .arrived = 0, .open = 0 };
+    cpool_node batch[COST_BATCH];
+    if (!pool || mtx_init(&g.mutex, mtx_plain) != thrd_success || cnd_init(&g.cond) != thrd_success) {
+        fprintf(stderr, "%s: initialization failed\n", label);
+        if (pool) cpool_destroy(pool);
+        return;
+    }
+    uint64_t total_ns = 0;
+    for (size_t round = 0; round < COST_ROUNDS; ++round) {
+        g.arrived = 0;
+        g.open    = 0;
+        for (size_t i = 0; i < nb_workers; ++i) cpool_enqueue(pool, gate_job, &g, NULL);
+        mtx_lock(&g.mutex);
+        while (g.arrived < nb_workers) cnd_wait(&g.cond, &g.mutex);
+        mtx_unlock(&g.mutex);
+
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < COST_BATCH; ++i) {
+            if (nodes) {
+                batch[i].func = empty_job;
+                cpool_enqueue_node(pool, batch + i);
+            } else {
+                cpool_enqueue(pool, empty_job, NULL, NULL);
+            }
+        }
+        total_ns += now_ns() - start;
+
+        mtx_lock(&g.mutex);
+        g.open = 1;
+        cnd_broadcast(&g.cond);
+        mtx_unlock(&g.mutex);
+        cpool_wait(pool);
+    }
+    printf("%-10s %8.1f ns/enqueue\n", label, (double)total_ns / (COST_ROUNDS * COST_BATCH));
+    cpool_destroy(pool);
+    cnd_destroy(&g.cond);
+    mtx_destroy(&g.mutex);
+}
+
+/* Value of a counter of the pool in its metrics, 0 if not found. */
+static unsigned long long
+metric_value(cpool* pool, const char* counter)
+{
+    static char buf[1 << 16];
+    const char* name = "bench";
+    char sample[128];
+    cpool_metrics_snprint(buf, sizeof(buf), &pool, &name, 1);
+    snprintf(sample, sizeof(sample), "%s_total{pool=\"bench\"} ", counter);
+    const char* found = strstr(buf, sample);
+    return found ? strtoull(found + strlen(sample), NULL, 10) : 0;
+}
+
+/* Print the cost of a membarrier(), as issued by parking workers, and of a full fence, as issued by
+ * producers without it. The pool registers the process for membarrier().
+ */
+static void
+fence_costs(void)
+{
+    enum { NB_FENCES = 1000000, NB_MEMBARRIERS = 10000 };
+    uint64_t start = now_ns();
+    for (int i = 0; i < NB_FENCES; ++i) atomic_thread_fence(memory_order_seq_cst);
+    double fence_ns = (double)(now_ns() - start) / NB_FENCES;
+#if defined(__linux__) && defined(SYS_membarrier)
+    start = now_ns();
+    for (int i = 0; i < NB_MEMBARRIERS; ++i) {
+        if (syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0)) {
+            printf("full fence %.1f ns, membarrier() unavailable\n", fence_ns);
+            return;
+        }
+    }
+    double membarrier_ns = (double)(now_ns() - start) / NB_MEMBARRIERS;
+    printf("full fence %.1f ns, membarrier() %.1f ns: break-even at %.0f jobs per park\n",
+           fence_ns, membarrier_ns, membarrier_ns / fence_ns);
+#else
+    printf("full fence %.1f ns, membarrier() unavailable\n", fence_ns);
+#endif
+}
+
+/* Enqueue lock-free jobs in bursts of `burst`, waiting for the pool to be idle after each.
+ * Prints the average time per job, and membarrier() calls per job.
+ */
+static void
+run_bursts(const char* label, cpool_engine engine, int nodes, size_t nb_workers, size_t burst)
+{
+    cpool_attr attr;
+    cpool_attr_init(&attr, nb_workers, burst);
+    attr.engine = engine;
+    cpool* pool = cpool_create_ex(&attr);
+    cpool_node* batch = calloc(burst, sizeof(*batch));
+    if (!pool || !batch) {
+        fprintf(stderr, "%s: allocation failed\n", label);
+        if (pool) cpool_destroy(pool);
+        free(batch);
+        return;
+    }
+    size_t nb_rounds = BURST_JOBS / burst;
+    uint64_t start = now_ns();
+    for (size_t round = 0; round < nb_rounds; ++round) {
+        for (size_t i = 0; i < burst; ++i) {
+            if (nodes) {
+                batch[i].func = empty_job;
+                cpool_enqueue_node(pool, batch + i);
+            } else {
+                cpool_enqueue(pool, empty_job, NULL, NULL);
+            }
+        }
+        cpool_wait(pool);
+    }
+    double nb_jobs = (double)nb_rounds * burst;
+    printf("%-10s burst %5zu %8.1f ns/job %8.4f membarrier/job %3llu fence switches\n", label, burst,
+           (now_ns() - start) / nb_jobs, metric_value(pool, "cpool_membarriers") / nb_jobs,
+           metric_value(pool, "cpool_fence_switches"));
+    cpool_destroy(pool);
+    free(batch);
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t nb_producers = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+    size_t nb_workers   = argc > 2 ? strtoul(argv[2], NULL, 10) : 4;
+    size_t nb_jobs      = argc > 3 ? strtoul(argv[3], NULL, 10) : 200000;
+    size_t max_jobs     = argc > 4 ? strtoul(argv[4], NULL, 10) : 1024;
+    if (!nb_producers || !nb_workers || !max_jobs) {
+        fprintf(stderr, "usage: %s [producers] [workers] [jobs per producer] [max_jobs]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu producers, %zu workers, %zu jobs per producer, queue of %zu\n",
+           nb_producers, nb_workers, nb_jobs, max_jobs);
+    run("mutex",     CPOOL_ENGINE_MUTEX,     0, nb_producers, nb_workers, nb_jobs, max_jobs);
+    run("combining", CPOOL_ENGINE_COMBINING, 0, nb_producers, nb_workers, nb_jobs, max_jobs);
+    run("adaptive",  CPOOL_ENGINE_ADAPTIVE,  0, nb_producers, nb_workers, nb_jobs, max_jobs);
+    run("percpu",    CPOOL_ENGINE_PERCPU,    0, nb_producers, nb_workers, nb_jobs, max_jobs);
+    run("nodes",     CPOOL_ENGINE_MUTEX,     1, nb_producers, nb_workers, nb_jobs, max_jobs);
+
+    printf("uncontended enqueue cost, %zu workers busy\n", nb_workers);
+    run_cost("mutex",     CPOOL_ENGINE_MUTEX,     0, nb_workers);
+    run_cost("combining", CPOOL_ENGINE_COMBINING, 0, nb_workers);
+    run_cost("percpu",    CPOOL_ENGINE_PERCPU,    0, nb_workers);
+    run_cost("nodes",     CPOOL_ENGINE_MUTEX,     1, nb_workers);
+
+    printf("bursty load, %zu workers\n", nb_workers);
+    fence_costs();
+    for (size_t burst = 1; burst <= 4096; burst *= 16) {
+        run_bursts("percpu", CPOOL_ENGINE_PERCPU, 0, nb_workers, burst);
+        run_bursts("nodes",  CPOOL_ENGINE_MUTEX,  1, nb_workers, burst);
+    }
+    return EXIT_SUCCESS;
+}
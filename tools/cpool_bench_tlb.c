@@ -0,0 +1,136 @@
+/*
+ * Benchmark of huge page backing of the job queue (`cpool_attr.hugepages`), Linux only.
+ *
+ * Fills a large queue while its single worker is held back, then drains it, once per huge page
+ * mode, counting dTLB load misses and wall time. The priority policy is used by default: its heap
+ * accesses are spread over the whole queue, which is where huge pages matter most.
+ * dTLB misses are counted with perf_event_open(2) for the process, including the worker,
+ * which requires a sufficiently low kernel.perf_event_paranoid.
+ *
+ * Build: cc -std=c11 -O2 -I. tools/cpool_bench_tlb.c cpool.c -o cpool_bench_tlb -lpthread
+ * Usage: cpool_bench_tlb [max_jobs] [fifo|priority]
+ */
+
+#define _GNU_SOURCE /* syscall() */
+
+#include "cpool.h"
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+static mtx_t gate_mutex;
+static cnd_t gate_cond;
+static int gate_open;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Holds the worker back until the queue is full. */
+static void
+gate_job(void* arg)
+{
+    (void)arg;
+    mtx_lock(&gate_mutex);
+    while (!gate_open) cnd_wait(&gate_cond, &gate_mutex);
+    mtx_unlock(&gate_mutex);
+}
+
+static void
+empty_job(void* arg)
+{
+    (void)arg;
+}
+
+/* Counter of dTLB load misses of this process, including threads created afterwards. -1 if unavailable. */
+static int
+open_dtlb_counter(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size     = sizeof(attr);
+    attr.type     = PERF_TYPE_HW_CACHE;
+    attr.config   = PERF_COUNT_HW_CACHE_DTLB
+                  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.inherit  = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void
+run(const char* label, cpool_hugepages mode, cpool_queue_policy policy, size_t max_jobs)
+{
+    int counter = open_dtlb_counter(); /* before creating the pool, so the worker inherits it */
+
+    cpool_attr attr;
+    cpool_attr_init(&attr, 1, max_jobs);
+    attr.queue_policy = policy;
+    attr.hugepages    = mode;
+    cpool* pool = cpool_create_ex(&attr);
+    if (!pool) {
+        fprintf(stderr, "%s: cannot create pool\n", label);
+        if (counter >= 0) close(counter);
+        return;
+    }
+    gate_open = 0;
+    cpool_future* gate;
+    cpool_enqueue(pool, gate_job, NULL, &gate);
+
+    uint64_t seed = 0x2545f4914f6cdd1du;
+    if (counter >= 0) ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < max_jobs; ++i) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17; /* xorshift64 */
+        cpool_enqueue_key(pool, empty_job, NULL, seed, NULL);
+    }
+    mtx_lock(&gate_mutex);
+    gate_open = 1;
+    mtx_unlock(&gate_mutex);
+    cnd_broadcast(&gate_cond);
+    cpool_wait(pool);
+    uint64_t elapsed = now_ns() - start;
+    long long misses = -1;
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) misses = -1;
+        close(counter);
+    }
+    cpool_wait_future(gate);
+    cpool_destroy(pool);
+
+    if (misses >= 0) printf("%-8s %10.3f ms %14lld dTLB load misses\n", label, elapsed / 1e6, misses);
+    else             printf("%-8s %10.3f ms %14s dTLB load misses\n", label, elapsed / 1e6, "n/a");
+}
+
+int
+main(int argc, char** argv)
+{
+    size_t max_jobs = argc > 1 ? strtoul(argv[1], NULL, 10) : (size_t)1 << 20;
+    cpool_queue_policy policy = argc > 2 && !strcmp(argv[2], "fifo") ? CPOOL_QUEUE_FIFO : CPOOL_QUEUE_PRIORITY;
+    if (!max_jobs) max_jobs = 1;
+    mtx_init(&gate_mutex, mtx_plain);
+    cnd_init(&gate_cond);
+
+    printf("%zu jobs, %s queue\n", max_jobs, policy == CPOOL_QUEUE_FIFO ? "fifo" : "priority");
+    run("none",    CPOOL_HUGEPAGES_NONE,    policy, max_jobs);
+    run("advise",  CPOOL_HUGEPAGES_ADVISE,  policy, max_jobs);
+    run("hugetlb", CPOOL_HUGEPAGES_HUGETLB, policy, max_jobs);
+
+    cnd_destroy(&gate_cond);
+    mtx_destroy(&gate_mutex);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,164 @@
+/*
+ * Replay a workload recorded with `cpool_record_start()` against a pool.
+ *
+ * Jobs are re-issued with their recorded arrival pattern: one thread stands in for each recorded
+ * submitting thread, and enqueues each of its jobs at the recorded enqueue time, as a synthetic
+ * job busy-looping for the recorded run time. On completion, the wall time and the metrics of the
+ * pool are printed, so queue wait and run time distributions can be compared across pool changes.
+ *
+ * Build: cc -std=c11 -O2 -I. tools/cpool_replay.c cpool.c -o cpool_replay -lpthread
+ * Usage: cpool_replay <recording> <nb_workers> <max_jobs> [speed]
+ *
+ * `speed` scales the arrival rate, e.g. 2 replays arrivals twice as fast. Run times are unscaled.
+ */
+
+#if !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+#endif
+
+#include "cpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <threads.h>
+#include <time.h>
+
+#define SPIN_BEFORE_NS 50000 /* submitters sleep until this close to an arrival, then spin */
+
+typedef struct {
+    cpool* pool;
+    const cpool_record* records; /* records of one submitting thread, ordered by enqueue time */
+    size_t nb_records;
+    uint64_t start_ns;
+    double speed;
+} submitter;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Wait for the arrival time of a job, sleeping first, so that idle submitters leave the CPUs to the pool. */
+static void
+wait_until(uint64_t deadline)
+{
+    for (;;) {
+        uint64_t now = now_ns();
+        if (now >= deadline) return;
+        if (deadline - now > SPIN_BEFORE_NS) {
+            uint64_t ns = deadline - now - SPIN_BEFORE_NS;
+            thrd_sleep(&(struct timespec) { .tv_sec = ns / 1000000000u, .tv_nsec = ns % 1000000000u }, NULL);
+        }
+    }
+}
+
+/* Synthetic job, keeping its worker's CPU busy for the recorded run time. */
+static void
+busy_job(void* arg)
+{
+    const cpool_record* record = arg;
+    uint64_t end = now_ns() + record->run_ns;
+    while (now_ns() < end) {}
+}
+
+static int
+submitter_func(void* arg)
+{
+    const submitter* sub = arg;
+    for (size_t i = 0; i < sub->nb_records; ++i) {
+        wait_until(sub->start_ns + (uint64_t)(sub->records[i].enqueue_ns / sub->speed));
+        if (cpool_enqueue(sub->pool, busy_job, (void*)(sub->records + i), NULL)) return 1;
+    }
+    return 0;
+}
+
+static int
+compare_records(const void* lhs, const void* rhs)
+{
+    const cpool_record* a = lhs;
+    const cpool_record* b = rhs;
+    if (a->thread != b->thread) return a->thread < b->thread ? -1 : 1;
+    if (a->enqueue_ns != b->enqueue_ns) return a->enqueue_ns < b->enqueue_ns ? -1 : 1;
+    return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <recording> <nb_workers> <max_jobs> [speed]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    size_t nb_workers = strtoul(argv[2], NULL, 10);
+    size_t max_jobs   = strtoul(argv[3], NULL, 10);
+    double speed      = argc > 4 ? strtod(argv[4], NULL) : 1.0;
+    if (!(speed > 0)) speed = 1.0;
+
+    FILE* in = fopen(argv[1], "rb");
+    if (!in || cpool_record_read_header(in)) {
+        fprintf(stderr, "cannot read recording %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    size_t nb_records = 0, capacity = 1024;
+    cpool_record* records = malloc(sizeof(*records) * capacity);
+    while (records && cpool_record_read(in, records + nb_records) == 0) {
+        if (++nb_records == capacity) {
+            capacity *= 2;
+            cpool_record* grown = realloc(records, sizeof(*records) * capacity);
+            if (!grown) free(records);
+            records = grown;
+        }
+    }
+    fclose(in);
+    if (!records) {
+        fputs("out of memory\n", stderr);
+        return EXIT_FAILURE;
+    }
+    qsort(records, nb_records, sizeof(*records), compare_records);
+
+    /* one submitter per recorded thread */
+    size_t nb_submitters = 0;
+    for (size_t i = 0; i < nb_records; ++i) {
+        if (i == 0 || records[i].thread != records[i - 1].thread) ++nb_submitters;
+    }
+    submitter* subs = calloc(nb_submitters ? nb_submitters : 1, sizeof(*subs));
+    thrd_t* threads = calloc(nb_submitters ? nb_submitters : 1, sizeof(*threads));
+    cpool* pool = cpool_create(nb_workers, max_jobs);
+    if (!subs || !threads || !pool) {
+        fputs("cannot create pool\n", stderr);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t start = now_ns() + 1000000; /* give submitters time to start */
+    size_t first = 0;
+    for (size_t s = 0; s < nb_submitters; ++s) {
+        size_t last = first + 1;
+        while (last < nb_records && records[last].thread == records[first].thread) ++last;
+        subs[s] = (submitter) {
+            .pool = pool, .records = records + first, .nb_records = last - first,
+            .start_ns = start, .speed = speed,
+        };
+        if (thrd_create(threads + s, submitter_func, subs + s) != thrd_success) {
+            fputs("cannot create submitter thread\n", stderr);
+            return EXIT_FAILURE;
+        }
+        first = last;
+    }
+    for (size_t s = 0; s < nb_submitters; ++s) thrd_join(threads[s], NULL);
+    cpool_wait(pool);
+    uint64_t end = now_ns();
+
+    printf("# replayed %zu jobs from %zu threads in %.6f s\n",
+           nb_records, nb_submitters, (end - start) / 1e9);
+    const char* name = "replay";
+    cpool_metrics_write(&pool, &name, 1, stdout);
+
+    cpool_destroy(pool);
+    free(threads);
+    free(subs);
+    free(records);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,480 @@
+/*
+ * Deterministic discrete-event simulator of the pool's scheduling.
+ *
+ * Models N workers, a bounded job queue, worker wake-up latency and per-operation costs,
+ * and replays a job trace under a queue policy, predicting makespan, queue wait percentiles
+ * and worker utilization. Queue policies are those of the pool (cpool_queue.h), so results
+ * transfer to a pool created with the same `queue_policy`.
+ *
+ * The model follows the pool: each enqueue wakes one parked worker, which starts taking jobs
+ * after the wake latency; a worker finishing a job takes the next one without parking;
+ * a submitter finding the queue full blocks until a worker frees a slot, delaying its later jobs.
+ *
+ * Policies:
+ *   fifo, lifo  the ring buffer of the pool
+ *   priority    lowest key first; the key is the job's run time (shortest job first)
+ *   edf         earliest deadline first; the deadline is enqueue time + deadline factor * run time
+ *   ws          work-stealing, not available in the pool: per-worker deques, fed round-robin by
+ *               submitting thread, popped LIFO by their owner and stolen FIFO by idle workers
+ *
+ * Traces are recordings made with `cpool_record_start()`, or generated: Poisson arrivals from a
+ * number of threads, with exponentially distributed run times.
+ *
+ * Build: cc -std=c11 -O2 -I. tools/cpool_sim.c cpool.c -o cpool_sim -lm -lpthread
+ * Usage: cpool_sim [options] [recording]
+ *   --workers=N          worker threads (default 4)
+ *   --capacity=N         queue capacity (default 64)
+ *   --policy=P           fifo, lifo, priority, edf, ws (default fifo)
+ *   --wake-ns=T          latency of waking a parked worker (default 20000)
+ *   --enqueue-ns=T       cost of an enqueue (default 200)
+ *   --dequeue-ns=T       cost of a dequeue (default 200)
+ *   --steal-ns=T         extra cost of a steal (default 500)
+ *   --deadline-factor=F  EDF deadline, in multiples of run time (default 4)
+ *   --jobs=N             generated trace: number of jobs (default 100000)
+ *   --threads=N          generated trace: submitting threads (default 4)
+ *   --rate=R             generated trace: arrivals per second, all threads (default 100000)
+ *   --run-ns=T           generated trace: mean run time (default 30000)
+ *   --seed=S             generated trace: random seed (default 1)
+ */
+
+#include "cpool_queue.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POLICY_WS -1
+
+typedef struct {
+    uint64_t arrival;  /* trace enqueue time */
+    uint64_t run;
+    uint32_t thread;   /* submitting thread, 0-based */
+} sim_job;
+
+typedef enum { EVENT_ARRIVAL, EVENT_WAKE, EVENT_DONE } event_type;
+
+typedef struct {
+    uint64_t time, seq;
+    event_type type;
+    size_t target;     /* job index for arrivals, worker index otherwise */
+} event;
+
+typedef struct {
+    event* items;
+    size_t count, capacity;
+    uint64_t seq;
+} event_heap;
+
+typedef struct {
+    size_t nb_workers, capacity;
+    int policy;        /* cpool_queue_policy, or POLICY_WS */
+    int edf;           /* with CPOOL_QUEUE_PRIORITY: key by deadline instead of run time */
+    uint64_t wake_ns, enqueue_ns, dequeue_ns, steal_ns;
+    double deadline_factor;
+} sim_config;
+
+typedef struct {
+    const sim_config* cfg;
+    const sim_job* jobs;
+    size_t nb_jobs, nb_threads;
+
+    event_heap events;
+    cpool_queue* queues;     /* one shared queue, or one per worker with POLICY_WS */
+    size_t nb_queues;
+    size_t* parked;          /* stack of parked workers */
+    size_t nb_parked;
+
+    size_t* thread_next;     /* per thread: index of its next job in `order` */
+    size_t* order;           /* job indices, grouped by thread, by arrival */
+    size_t* thread_end;      /* per thread: end of its range in `order` */
+    uint64_t* thread_delay;  /* per thread: accumulated blocking delay */
+    size_t* blocked;         /* FIFO of arrivals blocked on a full queue, at most one per thread */
+    size_t blocked_first, nb_blocked;
+
+    uint64_t* waits;
+    size_t nb_done;
+    uint64_t busy_ns, end_ns, nb_blocked_total;
+} sim;
+
+/* event heap, ordered by (time, seq) for determinism */
+
+static int
+event_less(const event* a, const event* b)
+{
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static void
+event_push(event_heap* h, uint64_t time, event_type type, size_t target)
+{
+    if (h->count == h->capacity) {
+        h->capacity = h->capacity ? 2 * h->capacity : 256;
+        h->items = realloc(h->items, sizeof(event) * h->capacity);
+        if (!h->items) {
+            fputs("out of memory\n", stderr);
+            exit(EXIT_FAILURE);
+        }
+    }
+    event e = { .time = time, .seq = h->seq++, .type = type, .target = target };
+    size_t i = h->count++;
+    while (i > 0 && event_less(&e, h->items + (i - 1) / 2)) {
+        h->items[i] = h->items[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    h->items[i] = e;
+}
+
+static event
+event_pop(event_heap* h)
+{
+    event top = h->items[0];
+    event last = h->items[--h->count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= h->count) break;
+        if (child + 1 < h->count && event_less(h->items + child + 1, h->items + child)) ++child;
+        if (!event_less(h->items + child, &last)) break;
+        h->items[i] = h->items[child];
+        i = child;
+    }
+    h->items[i] = last;
+    return top;
+}
+
+/* queues */
+
+static cpool_queue*
+target_queue(sim* s, const sim_job* job)
+{
+    return s->cfg->policy == POLICY_WS ? s->queues + job->thread % s->nb_queues : s->queues;
+}
+
+static void
+schedule_next_arrival(sim* s, uint32_t thread, uint64_t now)
+{
+    size_t next = s->thread_next[thread];
+    if (next == s->thread_end[thread]) return;
+    s->thread_next[thread] = next + 1;
+    size_t j = s->order[next];
+    uint64_t time = s->jobs[j].arrival + s->thread_delay[thread];
+    event_push(&s->events, time > now ? time : now, EVENT_ARRIVAL, j);
+}
+
+static void
+enqueue(sim* s, size_t j, uint64_t now)
+{
+    const sim_job* job = s->jobs + j;
+    uint64_t t = now + s->cfg->enqueue_ns;
+    cpool_work work = { .data = (void*)(uintptr_t)j, .enqueue_ns = t };
+    work.key = s->cfg->edf ? t + (uint64_t)(s->cfg->deadline_factor * (double)job->run) : job->run;
+    queue_push(target_queue(s, job), &work);
+
+    if (s->nb_parked) {
+        size_t w = s->parked[--s->nb_parked];
+        event_push(&s->events, t + s->cfg->wake_ns, EVENT_WAKE, w);
+    }
+    schedule_next_arrival(s, job->thread, t);
+}
+
+/* A worker looks for a job at `now`; parks if there is none. */
+static void
+worker_take(sim* s, size_t w, uint64_t now)
+{
+    cpool_queue* q = NULL;
+    uint64_t cost = s->cfg->dequeue_ns;
+    cpool_work work;
+    if (s->cfg->policy == POLICY_WS) {
+        if (s->queues[w].count) {
+            q = s->queues + w;
+            ring_pop_back(q, &work);
+        }
+        for (size_t i = 1; !q && i < s->nb_queues; ++i) {
+            cpool_queue* victim = s->queues + (w + i) % s->nb_queues;
+            if (!victim->count) continue;
+            q = victim;
+            ring_pop_front(q, &work);
+            cost += s->cfg->steal_ns;
+        }
+    }
+    else if (s->queues->count) {
+        q = s->queues;
+        queue_pop(q, &work);
+    }
+    if (!q) {
+        s->parked[s->nb_parked++] = w;
+        return;
+    }
+
+    size_t j = (size_t)(uintptr_t)work.data;
+    uint64_t start = now + cost;
+    s->waits[s->nb_done++] = start - work.enqueue_ns;
+    s->busy_ns += s->jobs[j].run;
+    event_push(&s->events, start + s->jobs[j].run, EVENT_DONE, w);
+
+    /* a slot was freed: admit the oldest blocked arrival for this queue */
+    for (size_t i = 0; i < s->nb_blocked; ++i) {
+        size_t slot = (s->blocked_first + i) % s->nb_threads;
+        size_t b = s->blocked[slot];
+        if (target_queue(s, s->jobs + b) != q) continue;
+        /* remove from the FIFO, keeping order */
+        for (size_t k = i; k > 0; --k) {
+            s->blocked[(s->blocked_first + k) % s->nb_threads] =
+                s->blocked[(s->blocked_first + k - 1) % s->nb_threads];
+        }
+        s->blocked_first = (s->blocked_first + 1) % s->nb_threads;
+        s->nb_blocked -= 1;
+        const sim_job* job = s->jobs + b;
+        uint64_t admitted = now + cost;
+        uint64_t due = job->arrival + s->thread_delay[job->thread];
+        if (admitted > due) s->thread_delay[job->thread] += admitted - due;
+        enqueue(s, b, admitted);
+        break;
+    }
+}
+
+static void
+arrival(sim* s, size_t j, uint64_t now)
+{
+    const sim_job* job = s->jobs + j;
+    cpool_queue* q = target_queue(s, job);
+    if (q->count == q->capacity) {
+        s->blocked[(s->blocked_first + s->nb_blocked++) % s->nb_threads] = j;
+        s->nb_blocked_total += 1;
+        return;
+    }
+    enqueue(s, j, now);
+}
+
+static int
+compare_u64(const void* lhs, const void* rhs)
+{
+    uint64_t a = *(const uint64_t*)lhs, b = *(const uint64_t*)rhs;
+    return a < b ? -1 : a > b;
+}
+
+static const sim_job* sort_jobs;
+
+static int
+compare_order(const void* lhs, const void* rhs)
+{
+    const sim_job* a = sort_jobs + *(const size_t*)lhs;
+    const sim_job* b = sort_jobs + *(const size_t*)rhs;
+    if (a->thread != b->thread) return a->thread < b->thread ? -1 : 1;
+    if (a->arrival != b->arrival) return a->arrival < b->arrival ? -1 : 1;
+    return *(const size_t*)lhs < *(const size_t*)rhs ? -1 : 1;
+}
+
+static void
+simulate(const sim_config* cfg, const sim_job* jobs, size_t nb_jobs, size_t nb_threads)
+{
+    sim s = { .cfg = cfg, .jobs = jobs, .nb_jobs = nb_jobs, .nb_threads = nb_threads };
+    s.nb_queues    = cfg->policy == POLICY_WS ? cfg->nb_workers : 1;
+    s.queues       = calloc(s.nb_queues, sizeof(*s.queues));
+    s.parked       = malloc(sizeof(size_t) * cfg->nb_workers);
+    s.thread_next  = calloc(nb_threads, sizeof(size_t));
+    s.thread_end   = calloc(nb_threads, sizeof(size_t));
+    s.thread_delay = calloc(nb_threads, sizeof(uint64_t));
+    s.order        = malloc(sizeof(size_t) * (nb_jobs ? nb_jobs : 1));
+    s.blocked      = malloc(sizeof(size_t) * nb_threads);
+    s.waits        = malloc(sizeof(uint64_t) * (nb_jobs ? nb_jobs : 1));
+    if (!s.queues || !s.parked || !s.thread_next || !s.thread_end || !s.thread_delay
+        || !s.order || !s.blocked || !s.waits) {
+        fputs("out of memory\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+    size_t queue_capacity = cfg->policy == POLICY_WS ? (cfg->capacity + s.nb_queues - 1) / s.nb_queues
+                                                     : cfg->capacity;
+    cpool_queue_policy policy = cfg->policy == POLICY_WS ? CPOOL_QUEUE_FIFO : (cpool_queue_policy)cfg->policy;
+    cpool_work* items = malloc(sizeof(cpool_work) * queue_capacity * s.nb_queues);
+    if (!items) {
+        fputs("out of memory\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < s.nb_queues; ++i) {
+        queue_init(s.queues + i, policy, items + i * queue_capacity, queue_capacity);
+    }
+
+    /* group jobs by thread; schedule the first arrival of each thread */
+    for (size_t j = 0; j < nb_jobs; ++j) s.order[j] = j;
+    sort_jobs = jobs;
+    qsort(s.order, nb_jobs, sizeof(size_t), compare_order);
+    for (size_t i = 0; i < nb_jobs; ++i) s.thread_end[jobs[s.order[i]].thread] = i + 1;
+    for (size_t t = 0, begin = 0; t < nb_threads; ++t) {
+        if (s.thread_end[t] < begin) s.thread_end[t] = begin; /* thread without jobs */
+        s.thread_next[t] = begin;
+        begin = s.thread_end[t];
+        schedule_next_arrival(&s, (uint32_t)t, 0);
+    }
+    for (size_t w = cfg->nb_workers; w > 0; --w) s.parked[s.nb_parked++] = w - 1;
+
+    uint64_t first_arrival = nb_jobs ? UINT64_MAX : 0;
+    for (size_t j = 0; j < nb_jobs; ++j) {
+        if (jobs[j].arrival < first_arrival) first_arrival = jobs[j].arrival;
+    }
+
+    while (s.events.count) {
+        event e = event_pop(&s.events);
+        switch (e.type) {
+        case EVENT_ARRIVAL: arrival(&s, e.target, e.time); break;
+        case EVENT_WAKE:    worker_take(&s, e.target, e.time); break;
+        case EVENT_DONE:
+            s.end_ns = e.time;
+            worker_take(&s, e.target, e.time);
+            break;
+        }
+    }
+
+    qsort(s.waits, s.nb_done, sizeof(uint64_t), compare_u64);
+    double makespan = (double)(s.end_ns - first_arrival);
+    double mean_wait = 0;
+    for (size_t i = 0; i < s.nb_done; ++i) mean_wait += (double)s.waits[i];
+    if (s.nb_done) mean_wait /= (double)s.nb_done;
+#define PERCENTILE(p) (s.nb_done ? s.waits[(size_t)((p) / 100.0 * (double)(s.nb_done - 1))] : 0)
+    printf("jobs           %zu\n", s.nb_done);
+    printf("makespan       %.6f s\n", makespan / 1e9);
+    printf("throughput     %.1f jobs/s\n", makespan > 0 ? s.nb_done / (makespan / 1e9) : 0.0);
+    printf("utilization    %.4f\n", makespan > 0 ? (double)s.busy_ns / (makespan * (double)cfg->nb_workers) : 0.0);
+    printf("blocked        %llu enqueues\n", (unsigned long long)s.nb_blocked_total);
+    printf("wait mean      %.0f ns\n", mean_wait);
+    printf("wait p50       %llu ns\n", (unsigned long long)PERCENTILE(50));
+    printf("wait p90       %llu ns\n", (unsigned long long)PERCENTILE(90));
+    printf("wait p99       %llu ns\n", (unsigned long long)PERCENTILE(99));
+    printf("wait p99.9     %llu ns\n", (unsigned long long)PERCENTILE(99.9));
+    printf("wait max       %llu ns\n", (unsigned long long)(s.nb_done ? s.waits[s.nb_done - 1] : 0));
+#undef PERCENTILE
+
+    free(items);
+    free(s.events.items);
+    free(s.queues);
+    free(s.parked);
+    free(s.thread_next);
+    free(s.thread_end);
+    free(s.thread_delay);
+    free(s.order);
+    free(s.blocked);
+    free(s.waits);
+}
+
+/* splitmix64, for reproducible generated traces */
+static uint64_t
+next_random(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15u);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    return z ^ (z >> 31);
+}
+
+static double
+next_exponential(uint64_t* state, double mean)
+{
+    double u = ((double)(next_random(state) >> 11) + 0.5) / 9007199254740992.0; /* (0, 1) */
+    return -mean * log(u);
+}
+
+static int
+parse_option(const char* arg, const char* name, const char** value)
+{
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) != 0 || arg[len] != '=') return 0;
+    *value = arg + len + 1;
+    return 1;
+}
+
+int
+main(int argc, char** argv)
+{
+    sim_config cfg = {
+        .nb_workers = 4, .capacity = 64, .policy = CPOOL_QUEUE_FIFO,
+        .wake_ns = 20000, .enqueue_ns = 200, .dequeue_ns = 200, .steal_ns = 500,
+        .deadline_factor = 4,
+    };
+    size_t nb_jobs = 100000, nb_threads = 4;
+    double rate = 100000, run_ns = 30000;
+    uint64_t seed = 1;
+    const char* recording = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* v;
+        if      (parse_option(argv[i], "--workers", &v))         cfg.nb_workers = strtoul(v, NULL, 10);
+        else if (parse_option(argv[i], "--capacity", &v))        cfg.capacity = strtoul(v, NULL, 10);
+        else if (parse_option(argv[i], "--wake-ns", &v))         cfg.wake_ns = strtoull(v, NULL, 10);
+        else if (parse_option(argv[i], "--enqueue-ns", &v))      cfg.enqueue_ns = strtoull(v, NULL, 10);
+        else if (parse_option(argv[i], "--dequeue-ns", &v))      cfg.dequeue_ns = strtoull(v, NULL, 10);
+        else if (parse_option(argv[i], "--steal-ns", &v))        cfg.steal_ns = strtoull(v, NULL, 10);
+        else if (parse_option(argv[i], "--deadline-factor", &v)) cfg.deadline_factor = strtod(v, NULL);
+        else if (parse_option(argv[i], "--jobs", &v))            nb_jobs = strtoul(v, NULL, 10);
+        else if (parse_option(argv[i], "--threads", &v))         nb_threads = strtoul(v, NULL, 10);
+        else if (parse_option(argv[i], "--rate", &v))            rate = strtod(v, NULL);
+        else if (parse_option(argv[i], "--run-ns", &v))          run_ns = strtod(v, NULL);
+        else if (parse_option(argv[i], "--seed", &v))            seed = strtoull(v, NULL, 10);
+        else if (parse_option(argv[i], "--policy", &v)) {
+            if      (!strcmp(v, "fifo"))     cfg.policy = CPOOL_QUEUE_FIFO;
+            else if (!strcmp(v, "lifo"))     cfg.policy = CPOOL_QUEUE_LIFO;
+            else if (!strcmp(v, "priority")) cfg.policy = CPOOL_QUEUE_PRIORITY;
+            else if (!strcmp(v, "edf"))      cfg.policy = CPOOL_QUEUE_PRIORITY, cfg.edf = 1;
+            else if (!strcmp(v, "ws"))       cfg.policy = POLICY_WS;
+            else {
+                fprintf(stderr, "unknown policy %s\n", v);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (argv[i][0] != '-') recording = argv[i];
+        else {
+            fprintf(stderr, "unknown option %s, see the top of tools/cpool_sim.c\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!cfg.nb_workers || !cfg.capacity || !nb_threads || !(rate > 0)) {
+        fputs("workers, capacity, threads and rate must be positive\n", stderr);
+        return EXIT_FAILURE;
+    }
+
+    sim_job* jobs = NULL;
+    if (recording) {
+        FILE* in = fopen(recording, "rb");
+        if (!in || cpool_record_read_header(in)) {
+            fprintf(stderr, "cannot read recording %s\n", recording);
+            return EXIT_FAILURE;
+        }
+        size_t capacity = 1024;
+        nb_jobs = 0;
+        nb_threads = 1;
+        jobs = malloc(sizeof(*jobs) * capacity);
+        cpool_record record;
+        while (jobs && cpool_record_read(in, &record) == 0) {
+            if (nb_jobs == capacity) {
+                capacity *= 2;
+                sim_job* grown = realloc(jobs, sizeof(*jobs) * capacity);
+                if (!grown) free(jobs);
+                jobs = grown;
+                if (!jobs) break;
+            }
+            uint32_t thread = record.thread ? record.thread - 1 : 0;
+            jobs[nb_jobs++] = (sim_job) { .arrival = record.enqueue_ns, .run = record.run_ns, .thread = thread };
+            if (thread >= nb_threads) nb_threads = thread + 1;
+        }
+        fclose(in);
+    }
+    else {
+        jobs = malloc(sizeof(*jobs) * (nb_jobs ? nb_jobs : 1));
+        double t = 0;
+        for (size_t j = 0; jobs && j < nb_jobs; ++j) {
+            t += next_exponential(&seed, 1e9 / rate);
+            jobs[j] = (sim_job) {
+                .arrival = (uint64_t)t,
+                .run     = (uint64_t)next_exponential(&seed, run_ns),
+                .thread  = (uint32_t)(next_random(&seed) % nb_threads),
+            };
+        }
+    }
+    if (!jobs) {
+        fputs("out of memory\n", stderr);
+        return EXIT_FAILURE;
+    }
+
+    simulate(&cfg, jobs, nb_jobs, nb_threads);
+    free(jobs);
+    return EXIT_SUCCESS;
+}